@@ -0,0 +1,220 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "CheckProfiler.h"
+
+#include <clang-tidy/ClangTidyDiagnosticConsumer.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace bitcoin {
+
+using clang::ast_matchers::MatchFinder;
+
+// Forwards to the wrapped check, timing each run(). Only the first wrapper
+// of each check forwards the TU callbacks, as the check itself is no longer
+// registered with the MatchFinder. Wrappers live as long as the checks and
+// MatchFinder of their TU, see configure().
+class CheckProfiler::ProfiledCallback final : public MatchFinder::MatchCallback {
+public:
+  ProfiledCallback(clang::tidy::ClangTidyCheck* check, llvm::StringRef matcher, bool forward_tu)
+      : m_check(check), m_matcher(matcher), m_forward_tu(forward_tu) {}
+
+  void run(const MatchFinder::MatchResult& Result) override
+  {
+    auto& profiler = CheckProfiler::instance();
+    const auto& sm = *Result.SourceManager;
+    const auto tu = sm.getFilename(sm.getLocForStartOfFile(sm.getMainFileID()));
+    auto& stats = profiler.stats(tu, callback()->getID(), m_matcher);
+
+    profiler.m_current = &stats;
+    const auto start = std::chrono::steady_clock::now();
+    callback()->run(Result);
+    stats.check_time += std::chrono::steady_clock::now() - start;
+    profiler.m_current = nullptr;
+
+    ++stats.matches;
+    stats.peak_bound_nodes = std::max(stats.peak_bound_nodes, Result.Nodes.getMap().size());
+  }
+
+  void onStartOfTranslationUnit() override
+  {
+    if (m_forward_tu) callback()->onStartOfTranslationUnit();
+  }
+
+  void onEndOfTranslationUnit() override
+  {
+    if (m_forward_tu) callback()->onEndOfTranslationUnit();
+  }
+
+  llvm::StringRef getID() const override
+  {
+    return callback()->getID();
+  }
+
+  llvm::Optional<clang::TraversalKind> getCheckTraversalKind() const override
+  {
+    return callback()->getCheckTraversalKind();
+  }
+
+private:
+  // run() and getID() are private in ClangTidyCheck, go through the base.
+  MatchFinder::MatchCallback* callback() const { return m_check; }
+
+  clang::tidy::ClangTidyCheck* m_check;
+  std::string m_matcher;
+  bool m_forward_tu;
+};
+
+CheckProfiler& CheckProfiler::instance()
+{
+  static CheckProfiler profiler;
+  return profiler;
+}
+
+CheckProfiler::~CheckProfiler()
+{
+  if (m_enabled) {
+    dump();
+  }
+}
+
+void CheckProfiler::configure(const clang::tidy::ClangTidyContext* Context)
+{
+  m_enabled |= Context->getEnableProfiling();
+  // clang-tidy constructs all checks of a TU, then registers their matchers.
+  // The first construction after a registration starts a new TU, whose
+  // checks may reuse the addresses of the previous TU's, now destroyed along
+  // with their MatchFinder and so with every use of the old wrappers.
+  if (!m_constructing) {
+    m_callbacks.clear();
+    m_constructing = true;
+  }
+}
+
+MatchFinder::MatchCallback* CheckProfiler::callback(clang::tidy::ClangTidyCheck* Check, llvm::StringRef Matcher)
+{
+  m_constructing = false;
+  if (!m_enabled) {
+    return Check;
+  }
+  const bool first = llvm::none_of(m_callbacks, [&](const auto& cb) { return cb->m_check == Check; });
+  m_callbacks.push_back(std::make_unique<ProfiledCallback>(Check, Matcher, first));
+  return m_callbacks.back().get();
+}
+
+void CheckProfiler::noteFixIts(unsigned Count)
+{
+  if (auto* current = instance().m_current) {
+    current->fixits += Count;
+  }
+}
+
+void CheckProfiler::noteCounter(llvm::StringRef Name, unsigned Count)
+{
+  if (auto* current = instance().m_current) {
+    current->counters[Name] += Count;
+  }
+}
+
+void CheckProfiler::noteTriggerGate(llvm::StringRef Check, bool Skipped)
+{
+  if (!m_enabled) {
+    return;
+  }
+  auto& gate = m_gates[Check.str()];
+  ++gate.translation_units;
+  gate.skipped += Skipped;
+}
+
+CheckProfiler::MatcherStats& CheckProfiler::stats(llvm::StringRef TU, llvm::StringRef Check, llvm::StringRef Matcher)
+{
+  return m_stats[TU.str()][(Check + "/" + Matcher).str()];
+}
+
+static void write_stats(llvm::json::OStream& json, llvm::StringRef name, const CheckProfiler::MatcherStats& stats)
+{
+  json.object([&] {
+    json.attribute("matcher", name);
+    json.attribute("matches", stats.matches);
+    json.attribute("check_seconds", std::chrono::duration<double>(stats.check_time).count());
+    json.attribute("fixits", stats.fixits);
+    json.attribute("peak_bound_nodes", static_cast<int64_t>(stats.peak_bound_nodes));
+    json.attributeObject("counters", [&] {
+      for (const auto& counter : stats.counters) {
+        json.attribute(counter.getKey(), counter.getValue());
+      }
+    });
+  });
+}
+
+void CheckProfiler::dump() const
+{
+  // Own the stream: this runs from a static destructor, llvm::errs() may
+  // already be gone.
+  std::error_code ec;
+  std::unique_ptr<llvm::raw_fd_ostream> os;
+  if (const char* path = std::getenv("BITCOIN_TIDY_PROFILE")) {
+    os = std::make_unique<llvm::raw_fd_ostream>(path, ec, llvm::sys::fs::OF_Text);
+  }
+  if (!os || ec) {
+    os = std::make_unique<llvm::raw_fd_ostream>(2, /*shouldClose=*/false);
+  }
+
+  std::map<std::string, MatcherStats> totals;
+  for (const auto& tu : m_stats) {
+    for (const auto& [name, stats] : tu.second) {
+      auto& total = totals[name];
+      total.matches += stats.matches;
+      total.check_time += stats.check_time;
+      total.fixits += stats.fixits;
+      total.peak_bound_nodes = std::max(total.peak_bound_nodes, stats.peak_bound_nodes);
+      for (const auto& counter : stats.counters) {
+        total.counters[counter.getKey()] += counter.getValue();
+      }
+    }
+  }
+
+  llvm::json::OStream json(*os, 2);
+  json.object([&] {
+    json.attributeArray("totals", [&] {
+      for (const auto& [name, stats] : totals) {
+        write_stats(json, name, stats);
+      }
+    });
+    json.attributeArray("trigger_gates", [&] {
+      for (const auto& [check, gate] : m_gates) {
+        json.object([&] {
+          json.attribute("check", check);
+          json.attribute("translation_units", gate.translation_units);
+          json.attribute("skipped", gate.skipped);
+          json.attribute("skip_rate", gate.translation_units ? static_cast<double>(gate.skipped) / gate.translation_units : 0.0);
+        });
+      }
+    });
+    json.attributeArray("translation_units", [&] {
+      for (const auto& tu : m_stats) {
+        json.object([&] {
+          json.attribute("file", tu.first);
+          json.attributeArray("matchers", [&] {
+            for (const auto& [name, stats] : tu.second) {
+              write_stats(json, name, stats);
+            }
+          });
+        });
+      }
+    });
+  });
+  *os << "\n";
+}
+
+} // namespace bitcoin
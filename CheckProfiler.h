@@ -0,0 +1,83 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CHECK_PROFILER_H
+#define CHECK_PROFILER_H
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/StringMap.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Opt-in per-matcher instrumentation shared by all bitcoin checks.
+//
+// Enabled by clang-tidy's --enable-check-profile. Matchers registered through
+// callback() are then wrapped so that match counts, time spent in check(),
+// fix-its and peak bound nodes are recorded per matcher and per TU. The
+// results are dumped as JSON at exit, to the file named by
+// $BITCOIN_TIDY_PROFILE or to stderr.
+class CheckProfiler {
+public:
+  struct MatcherStats {
+    uint64_t matches{0};
+    std::chrono::steady_clock::duration check_time{0};
+    uint64_t fixits{0};
+    size_t peak_bound_nodes{0};
+    llvm::StringMap<uint64_t> counters;
+  };
+
+  static CheckProfiler& instance();
+
+  // Called from each check's constructor.
+  void configure(const clang::tidy::ClangTidyContext* Context);
+  bool enabled() const { return m_enabled; }
+
+  // The callback to register a matcher with: the check itself when profiling
+  // is disabled, otherwise a timing wrapper around it.
+  clang::ast_matchers::MatchFinder::MatchCallback* callback(clang::tidy::ClangTidyCheck* Check, llvm::StringRef Matcher);
+
+  // Attribute fix-its or a named counter to the matcher whose check() is
+  // currently running. No-ops when profiling is disabled.
+  static void noteFixIts(unsigned Count);
+  static void noteCounter(llvm::StringRef Name, unsigned Count = 1);
+
+  // Record whether a check's TriggerGate skipped the current TU.
+  void noteTriggerGate(llvm::StringRef Check, bool Skipped);
+
+  ~CheckProfiler();
+
+private:
+  class ProfiledCallback;
+  friend class ProfiledCallback;
+
+  CheckProfiler() = default;
+  MatcherStats& stats(llvm::StringRef TU, llvm::StringRef Check, llvm::StringRef Matcher);
+  void dump() const;
+
+  bool m_enabled{false};
+  MatcherStats* m_current{nullptr};
+  // Wrappers of the current TU's checks only.
+  std::vector<std::unique_ptr<ProfiledCallback>> m_callbacks;
+  // Between the first check constructor of a TU and its first callback().
+  bool m_constructing{false};
+  // TU -> "check/matcher" -> stats
+  std::map<std::string, std::map<std::string, MatcherStats>> m_stats;
+  struct GateStats {
+    uint64_t translation_units{0};
+    uint64_t skipped{0};
+  };
+  // check -> TUs gated
+  std::map<std::string, GateStats> m_gates;
+};
+
+} // namespace bitcoin
+
+#endif // CHECK_PROFILER_H
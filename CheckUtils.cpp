@@ -0,0 +1,337 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "CheckUtils.h"
+
+#include <clang/AST/Attr.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Analysis/Analyses/ExprMutationAnalyzer.h>
+#include <clang/Lex/Lexer.h>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+
+namespace {
+
+static const clang::Expr* strip(const clang::Expr* expr)
+{
+    return expr ? expr->IgnoreParenImpCasts() : nullptr;
+}
+
+// The body plus constructor initializers, where sinks usually live.
+static llvm::SmallVector<const clang::Stmt*, 4> function_scopes(const clang::FunctionDecl* func)
+{
+    llvm::SmallVector<const clang::Stmt*, 4> scopes;
+    if (const auto* ctor = llvm::dyn_cast<clang::CXXConstructorDecl>(func)) {
+        for (const auto* init : ctor->inits()) {
+            if (init->isWritten() && init->getInit()) scopes.push_back(init->getInit());
+        }
+    }
+    if (func->getBody()) {
+        scopes.push_back(func->getBody());
+    }
+    return scopes;
+}
+
+static const clang::ParmVarDecl* instantiation_pattern_param(const clang::FunctionDecl* callee, unsigned index)
+{
+    // Only function templates can have forwarding references. Plain members
+    // of a class template specialization (vector<T>::push_back(const T&))
+    // have a pattern too, but their T&& alternative is a separate overload.
+    if (!callee->getPrimaryTemplate()) {
+        return nullptr;
+    }
+    const auto* pattern = callee->getTemplateInstantiationPattern();
+    if (!pattern || pattern->getNumParams() == 0) {
+        return nullptr;
+    }
+    if (index < pattern->getNumParams() && !pattern->getParamDecl(index)->isParameterPack()) {
+        return pattern->getParamDecl(index);
+    }
+    const auto* last = pattern->getParamDecl(pattern->getNumParams() - 1);
+    return last->isParameterPack() ? last : nullptr;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+llvm::StringRef get_source_text(clang::SourceRange range, const clang::SourceManager& sm, const clang::LangOptions& lo)
+{
+    // Mostly from https://stackoverflow.com/questions/11083066/getting-the-source-behind-clangs-ast
+    const auto& start_loc = sm.getSpellingLoc(range.getBegin());
+    const auto& last_token_loc = sm.getSpellingLoc(range.getEnd());
+    const auto& end_loc = clang::Lexer::getLocForEndOfToken(last_token_loc, 0, sm, lo);
+    const auto& char_range = clang::CharSourceRange::getCharRange({start_loc, end_loc});
+    return clang::Lexer::getSourceText(char_range, sm, lo);
+}
+
+std::vector<std::string> parse_list(llvm::StringRef list)
+{
+    llvm::SmallVector<llvm::StringRef, 8> items;
+    list.split(items, ';', -1, false);
+    std::vector<std::string> ret;
+    for (auto item : items) {
+        item = item.trim();
+        if (!item.empty()) {
+            ret.push_back(item.str());
+        }
+    }
+    return ret;
+}
+
+std::string join_list(const std::vector<std::string>& items)
+{
+    std::string ret;
+    for (const auto& item : items) {
+        if (!ret.empty()) ret += ";";
+        ret += item;
+    }
+    return ret;
+}
+
+bool is_listed_function(const clang::FunctionDecl* func, const std::vector<std::string>& names)
+{
+    const auto qualified = func->getQualifiedNameAsString();
+    return llvm::any_of(names, [&](const std::string& name) {
+        return name == qualified || (func->getIdentifier() && name == func->getName());
+    });
+}
+
+TypeList::TypeList(llvm::StringRef list) : m_names(parse_list(list))
+{
+    for (const auto& name : m_names) {
+        Entry entry;
+        llvm::StringRef ref{name};
+        const auto open = ref.find('<');
+        entry.name = ref.substr(0, open).trim().str();
+        if (open != llvm::StringRef::npos) {
+            // Split the arguments on top-level commas.
+            auto args = ref.substr(open + 1).rtrim().drop_back();
+            int depth = 0;
+            size_t start = 0;
+            for (size_t i = 0; i <= args.size(); ++i) {
+                if (i == args.size() || (args[i] == ',' && depth == 0)) {
+                    entry.args.push_back(args.slice(start, i).trim().str());
+                    start = i + 1;
+                } else if (args[i] == '<') {
+                    ++depth;
+                } else if (args[i] == '>') {
+                    --depth;
+                }
+            }
+        }
+        m_entries.push_back(std::move(entry));
+    }
+}
+
+bool TypeList::contains(clang::QualType type, const clang::ASTContext& ctx) const
+{
+    const auto* record = type.getCanonicalType()->getAsCXXRecordDecl();
+    if (!record) {
+        return false;
+    }
+    const auto name = record->getQualifiedNameAsString();
+    clang::PrintingPolicy policy(ctx.getLangOpts());
+    for (const auto& entry : m_entries) {
+        if (entry.name != name) {
+            continue;
+        }
+        if (entry.args.empty()) {
+            return true;
+        }
+        const auto* spec = llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(record);
+        if (!spec || spec->getTemplateArgs().size() < entry.args.size()) {
+            continue;
+        }
+        bool match = true;
+        for (size_t i = 0; i < entry.args.size() && match; ++i) {
+            const auto& arg = spec->getTemplateArgs()[i];
+            match = arg.getKind() == clang::TemplateArgument::Type &&
+                    arg.getAsType().getCanonicalType().getAsString(policy) == entry.args[i];
+        }
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_copy_source(const clang::DeclRefExpr* use, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*use);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1) {
+            return false;
+        }
+        node = parents[0];
+        if (node.get<clang::ImplicitCastExpr>() || node.get<clang::ParenExpr>()) {
+            continue;
+        }
+        if (const auto* construct = node.get<clang::CXXConstructExpr>()) {
+            return construct->getConstructor()->isCopyConstructor() && construct->getNumArgs() >= 1 && strip(construct->getArg(0)) == use;
+        }
+        if (const auto* op = node.get<clang::CXXOperatorCallExpr>()) {
+            const auto* method = llvm::dyn_cast_or_null<clang::CXXMethodDecl>(op->getDirectCallee());
+            return method && method->isCopyAssignmentOperator() && op->getNumArgs() == 2 && strip(op->getArg(1)) == use;
+        }
+        return false;
+    }
+}
+
+bool has_rvalue_alternative(const clang::FunctionDecl* callee, unsigned index)
+{
+    if (const auto* param = instantiation_pattern_param(callee, index)) {
+        auto type = param->getType();
+        if (const auto* pack = type->getAs<clang::PackExpansionType>()) {
+            type = pack->getPattern();
+        }
+        const auto* ref = type->getAs<clang::RValueReferenceType>();
+        return ref && !ref->getPointeeType().hasQualifiers() && ref->getPointeeType()->getAs<clang::TemplateTypeParmType>();
+    }
+    const auto* method = llvm::dyn_cast<clang::CXXMethodDecl>(callee);
+    if (!method || !method->getIdentifier()) {
+        return false;
+    }
+    const auto pointee = callee->getParamDecl(index)->getType()->getPointeeType().getUnqualifiedType().getCanonicalType();
+    for (const auto* other : method->getParent()->methods()) {
+        if (other == method || other->getDeclName() != method->getDeclName() || other->getNumParams() != method->getNumParams()) {
+            continue;
+        }
+        bool match = true;
+        for (unsigned i = 0; i < other->getNumParams() && match; ++i) {
+            const auto type = other->getParamDecl(i)->getType().getCanonicalType();
+            if (i == index) {
+                match = type->isRValueReferenceType() && type->getPointeeType().getUnqualifiedType() == pointee;
+            } else {
+                match = type == method->getParamDecl(i)->getType().getCanonicalType();
+            }
+        }
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_std_move_arg(const clang::DeclRefExpr* use, clang::ASTContext& ctx)
+{
+    for (const auto& parent : ctx.getParents(*use)) {
+        const auto* call = parent.get<clang::CallExpr>();
+        if (!call || call->getNumArgs() != 1) continue;
+        const auto* callee = call->getDirectCallee();
+        if (callee && callee->isInStdNamespace() && callee->getName() == "move") {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool make_const_ref(const clang::DeclaratorDecl* var, clang::DiagnosticBuilder& user_diag, const clang::SourceManager& sm, const clang::LangOptions& lo)
+{
+    const auto* tsi = var->getTypeSourceInfo();
+    if (!tsi) {
+        return false;
+    }
+    const auto range = tsi->getTypeLoc().getSourceRange();
+    if (range.isInvalid() || range.getBegin().isMacroID() || range.getEnd().isMacroID()) {
+        return false;
+    }
+    const auto end = clang::Lexer::getLocForEndOfToken(range.getEnd(), 0, sm, lo);
+    if (!var->getType().isLocalConstQualified()) {
+        user_diag << clang::FixItHint::CreateInsertion(range.getBegin(), "const ");
+    }
+    user_diag << clang::FixItHint::CreateInsertion(end, "&");
+    return true;
+}
+
+bool add_std_move(const clang::Expr* expr, clang::DiagnosticBuilder& user_diag, const clang::SourceManager& sm, const clang::LangOptions& lo)
+{
+    const auto range = expr->getSourceRange();
+    if (range.isInvalid() || range.getBegin().isMacroID() || range.getEnd().isMacroID()) {
+        return false;
+    }
+    user_diag << clang::FixItHint::CreateInsertion(range.getBegin(), "std::move(")
+              << clang::FixItHint::CreateInsertion(clang::Lexer::getLocForEndOfToken(range.getEnd(), 0, sm, lo), ")");
+    return true;
+}
+
+llvm::SmallVector<const clang::DeclRefExpr*, 4> find_uses(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx)
+{
+    using namespace clang::ast_matchers;
+    llvm::SmallVector<const clang::DeclRefExpr*, 4> uses;
+    for (const auto* scope : function_scopes(func)) {
+        for (const auto& node : match(findAll(declRefExpr(to(varDecl(equalsNode(var)))).bind("use")), *scope, ctx)) {
+            uses.push_back(node.getNodeAs<clang::DeclRefExpr>("use"));
+        }
+    }
+    return uses;
+}
+
+bool is_mutated(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx)
+{
+    for (const auto* scope : function_scopes(func)) {
+        if (clang::ExprMutationAnalyzer(*scope, ctx).isMutated(var)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const clang::Expr* full_expression(const clang::Expr* expr, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*expr);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1 || !parents[0].get<clang::Expr>()) {
+            return expr;
+        }
+        node = parents[0];
+        expr = node.get<clang::Expr>();
+    }
+}
+
+const clang::Stmt* enclosing_loop(const clang::Stmt* stmt, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*stmt);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty()) {
+            return nullptr;
+        }
+        node = parents[0];
+        if (node.get<clang::FunctionDecl>() || node.get<clang::LambdaExpr>()) {
+            return nullptr;
+        }
+        if (const auto* s = node.get<clang::Stmt>()) {
+            if (llvm::isa<clang::ForStmt, clang::WhileStmt, clang::DoStmt, clang::CXXForRangeStmt>(s)) {
+                return s;
+            }
+        }
+    }
+}
+
+FieldLayout field_layout(const clang::FieldDecl* field, const clang::ASTContext& ctx)
+{
+    auto type = field->getType();
+    if (type->isReferenceType()) {
+        type = ctx.getPointerType(type.getNonReferenceType());
+    }
+    return {static_cast<uint64_t>(ctx.getTypeSizeInChars(type).getQuantity()), static_cast<uint64_t>(ctx.getDeclAlign(field).getQuantity())};
+}
+
+bool has_sequential_layout(const clang::CXXRecordDecl* record)
+{
+    if (record->getNumVBases() > 0) {
+        return false;
+    }
+    return llvm::none_of(record->fields(), [](const clang::FieldDecl* field) {
+        return field->isBitField() || field->hasAttr<clang::NoUniqueAddressAttr>() || field->getType()->isIncompleteArrayType();
+    });
+}
+
+} // namespace bitcoin
@@ -0,0 +1,102 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CHECK_UTILS_H
+#define CHECK_UTILS_H
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Source text covered by range, including its last token.
+llvm::StringRef get_source_text(clang::SourceRange range, const clang::SourceManager& sm, const clang::LangOptions& lo);
+
+// Splits a semicolon separated check option into its trimmed, non-empty items.
+std::vector<std::string> parse_list(llvm::StringRef list);
+
+// Joins items back into the form parse_list() accepts, for storeOptions().
+std::string join_list(const std::vector<std::string>& items);
+
+// Whether func's name or qualified name (e.g. "CSHA256::Write") is listed.
+bool is_listed_function(const clang::FunctionDecl* func, const std::vector<std::string>& names);
+
+// Type names from a check option, e.g. "CScript" or "std::vector<unsigned char>".
+// Template arguments given in the name must match the leading arguments of the
+// specialization, the rest (allocators etc) are ignored.
+class TypeList {
+public:
+  explicit TypeList(llvm::StringRef list);
+
+  bool contains(clang::QualType type, const clang::ASTContext& ctx) const;
+  const std::vector<std::string>& names() const { return m_names; }
+  std::string str() const { return join_list(m_names); }
+
+private:
+  struct Entry {
+    std::string name;
+    std::vector<std::string> args;
+  };
+  std::vector<std::string> m_names;
+  std::vector<Entry> m_entries;
+};
+
+// Whether use is the source of a copy construction or copy assignment.
+bool is_copy_source(const clang::DeclRefExpr* use, clang::ASTContext& ctx);
+
+// Whether use is the argument of std::move.
+bool is_std_move_arg(const clang::DeclRefExpr* use, clang::ASTContext& ctx);
+
+// Whether the lvalue reference parameter index of callee has an rvalue
+// alternative that a std::move'd argument would pick instead: a forwarding
+// reference, or a T&& overload such as push_back(value_type&&).
+bool has_rvalue_alternative(const clang::FunctionDecl* callee, unsigned index);
+
+// Turns "T name" into "const T& name". Returns false if the type is spelled
+// by a macro.
+bool make_const_ref(const clang::DeclaratorDecl* var, clang::DiagnosticBuilder& user_diag, const clang::SourceManager& sm, const clang::LangOptions& lo);
+
+// Wraps expr in std::move(). Returns false if it is spelled by a macro.
+bool add_std_move(const clang::Expr* expr, clang::DiagnosticBuilder& user_diag, const clang::SourceManager& sm, const clang::LangOptions& lo);
+
+// References to var in func's body and constructor initializers.
+llvm::SmallVector<const clang::DeclRefExpr*, 4> find_uses(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx);
+
+// Whether func's body or constructor initializers may modify var.
+bool is_mutated(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx);
+
+// The outermost expression containing expr, e.g. the whole call it is an
+// argument of.
+const clang::Expr* full_expression(const clang::Expr* expr, clang::ASTContext& ctx);
+
+// The innermost loop statement enclosing stmt within its function, or nullptr.
+const clang::Stmt* enclosing_loop(const clang::Stmt* stmt, clang::ASTContext& ctx);
+
+// Bytes a field takes up in its record, and their alignment. References
+// count as pointers.
+struct FieldLayout {
+  uint64_t size;
+  uint64_t align;
+};
+FieldLayout field_layout(const clang::FieldDecl* field, const clang::ASTContext& ctx);
+
+// Whether record's fields are simply placed one after another at their
+// alignment, so a different order or alignment can be simulated: no
+// bit-fields, virtual bases, [[no_unique_address]] or flexible array members.
+bool has_sequential_layout(const clang::CXXRecordDecl* record);
+
+} // namespace bitcoin
+
+#endif // CHECK_UTILS_H
@@ -3,255 +3,529 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "EarlyExitTidyModule.h"
+#include "CheckUtils.h"
 
 #include <clang/AST/ASTContext.h>
+#include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/ASTMatchers/ASTMatchFinder.h>
 #include <clang/Lex/Lexer.h>
 
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
 namespace {
 
-static llvm::StringRef get_source_text(clang::SourceRange range, const clang::SourceManager& sm, const clang::LangOptions& lo) {
-    // Mostly from https://stackoverflow.com/questions/11083066/getting-the-source-behind-clangs-ast
-    const auto& start_loc = sm.getSpellingLoc(range.getBegin());
-    const auto& last_token_loc = sm.getSpellingLoc(range.getEnd());
-    const auto& end_loc = clang::Lexer::getLocForEndOfToken(last_token_loc, 0, sm, lo);
-    const auto& char_range = clang::CharSourceRange::getCharRange({start_loc, end_loc});
-    return clang::Lexer::getSourceText(char_range, sm, lo);
+static bool is_early_exit_type(clang::QualType type)
+{
+    const auto* record = type->getAsCXXRecordDecl();
+    return record && record->getName() == "MaybeEarlyExit";
 }
-} // anonymous namespace
-
-namespace bitcoin {
-
-  void PropagateEarlyExitCheck::registerMatchers(clang::ast_matchers::MatchFinder *Finder) {
-  using namespace clang::ast_matchers;
-    auto matchtype = qualType(hasDeclaration(classTemplateSpecializationDecl(hasName("MaybeEarlyExit"))));
-    Finder->addMatcher(
-     callExpr(
-       anyOf(hasType(matchtype),callee(functionDecl(hasName("ShutdownRequested"))),callee(functionDecl(hasName("StartShutdown")))),
-       forCallable(functionDecl(
-         unless(isMain()),
-         unless(returns(matchtype)),
-         optionally(hasBody(compoundStmt(unless(hasAnySubstatement(returnStmt()))).bind("stmt_needs_return")))
-       ).bind("func_should_early_exit"))
-     ).bind("early_exit_call")
-    , this);
-
-
-    // Match bare "return;" statements in a functions that should now
-    // return MaybeEarlyExit.
-    Finder->addMatcher(
-     returnStmt(
-      forCallable(
-       functionDecl(
-        hasDescendant(
-         callExpr(
-          anyOf(hasType(matchtype),callee(functionDecl(hasName("ShutdownRequested"))),callee(functionDecl(hasName("StartShutdown"))))
-         )))),
-      unless(
-       has(
-        expr()))).bind("naked_return"), this);
-
-    Finder->addMatcher(
-      ifStmt(hasCondition(expr(
-        hasDescendant(callExpr(hasType(matchtype)).bind("if_call_expr")),
-        unless(hasDescendant(unaryOperator(hasOperatorName("!"), hasDescendant(callExpr(hasType(matchtype))))))
-      ))
-    ).bind("conditional_early_exit"), this);
 
-    Finder->addMatcher(
-      ifStmt(hasCondition(
-        hasDescendant(unaryOperator(hasOperatorName("!"), hasDescendant(callExpr(hasType(matchtype)).bind("if_not_call_expr"))).bind("not_operator"))
-      )
-    ).bind("conditional_not_early_exit"), this);
-
-    Finder->addMatcher(traverse(clang::TK_IgnoreUnlessSpelledInSource,
-      binaryOperation(
-        isAssignmentOperator(),
-        hasRHS(callExpr(hasType(matchtype)).bind("assign_call_expr")),
-        hasLHS(expr().bind("lhs"))
-    ).bind("early_exit_assignment")), this);
-
-    Finder->addMatcher(traverse(clang::TK_IgnoreUnlessSpelledInSource,
-      declStmt(
-        unless(isExpandedFromMacro("MAYBE_EXIT")),
-        unless(isExpandedFromMacro("EXIT_OR_DECL")),
-        unless(isExpandedFromMacro("EXIT_OR_ASSIGN")),
-        unless(isExpandedFromMacro("EXIT_OR_IF")),
-        unless(isExpandedFromMacro("EXIT_OR_IF_NOT")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_DECL")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_ASSIGN")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_IF")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_IF_NOT")),
-        unless(isExpandedFromMacro("NOOP_MAYBE_EXIT")),
-        has(varDecl(
-          hasInitializer(callExpr(hasType(matchtype)).bind("callsite"))).bind("vardecl")
-      ))
-    .bind("declstmt")), this);
-
-    Finder->addMatcher(traverse(clang::TK_IgnoreUnlessSpelledInSource,
-        callExpr(hasType(matchtype),
-        unless(hasParent(returnStmt())),
-        unless(isExpandedFromMacro("EXIT_OR_DECL")),
-        unless(isExpandedFromMacro("EXIT_OR_ASSIGN")),
-        unless(isExpandedFromMacro("EXIT_OR_IF")),
-        unless(isExpandedFromMacro("EXIT_OR_IF_NOT")),
-        unless(isExpandedFromMacro("MAYBE_EXIT")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_DECL")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_ASSIGN")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_IF")),
-        unless(isExpandedFromMacro("NOOP_EXIT_OR_IF_NOT")),
-        unless(isExpandedFromMacro("NOOP_MAYBE_EXIT")),
-        unless(isExpandedFromMacro("BUBBLE_UP"))
-    ).bind("unused_early_exit")), this);
-
-    Finder->addMatcher(traverse(clang::TK_IgnoreUnlessSpelledInSource,
-        returnStmt(has(callExpr(hasType(matchtype)).bind("bubble_up_expr"))
-    )), this);
+static bool is_shutdown_root(const clang::FunctionDecl* decl)
+{
+    const auto* ident = decl->getIdentifier();
+    return ident && (ident->getName() == "ShutdownRequested" || ident->getName() == "StartShutdown");
+}
 
-  }
+// Stable cross-TU name for a function. The return type is deliberately left
+// out so that the key survives the rewrite from T to MaybeEarlyExit<T>.
+// Functions with internal linkage are qualified by the file they live in.
+static std::string function_key(const clang::FunctionDecl* decl, const clang::SourceManager& sm)
+{
+    const auto* canon = decl->getCanonicalDecl();
+    std::string key;
+    if (!canon->isExternallyVisible()) {
+        key += sm.getFilename(sm.getSpellingLoc(canon->getLocation()));
+        key += "::";
+    }
+    key += canon->getQualifiedNameAsString();
+    key += "(";
+    for (unsigned i = 0; i < canon->getNumParams(); ++i) {
+        if (i) key += ", ";
+        key += canon->getParamDecl(i)->getType().getCanonicalType().getAsString();
+    }
+    key += ")";
+    if (const auto* method = llvm::dyn_cast<clang::CXXMethodDecl>(canon)) {
+        if (method->isConst()) key += " const";
+    }
+    return key;
+}
 
-  void PropagateEarlyExitCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result) {
-    static llvm::SmallSet<int64_t, 8> g_decls;
-    static llvm::SmallSet<int64_t, 8> g_calls;
+// The identifier a TU calling a closure function must mention: "ns::Foo(int)"
+// is triggered by Foo, member operators and destructors by their class. Free
+// operators give an empty name, which always triggers. Foo may be a member
+// function, which only a lookup into its class would find, so these are added
+// to the gate as spelled.
+static llvm::StringRef closure_trigger(llvm::StringRef key)
+{
+    const auto last = [](llvm::StringRef qualified) {
+        const auto pos = qualified.rfind("::");
+        return pos == llvm::StringRef::npos ? qualified : qualified.substr(pos + 2);
+    };
+    const auto qualified = key.substr(0, key.find('('));
+    const auto name = last(qualified);
+    if (name.startswith("operator") || name.startswith("~")) {
+        const auto scope = qualified.drop_back(name.size());
+        return scope.empty() ? scope : last(scope.drop_back(2));
+    }
+    return name;
+}
 
-    const auto& sm = *Result.SourceManager;
-    if (const auto *decl = Result.Nodes.getNodeAs<clang::FunctionDecl>("func_should_early_exit")) {
-        if(!g_decls.insert(decl->getID()).second) {
-            return;
+// Early-exit macros whose expansions must not be rewritten again.
+static constexpr llvm::StringLiteral g_early_exit_macros[] = {
+    "MAYBE_EXIT",
+    "EXIT_OR_DECL",
+    "EXIT_OR_ASSIGN",
+    "EXIT_OR_IF",
+    "EXIT_OR_IF_NOT",
+    "NOOP_EXIT_OR_DECL",
+    "NOOP_EXIT_OR_ASSIGN",
+    "NOOP_EXIT_OR_IF",
+    "NOOP_EXIT_OR_IF_NOT",
+    "NOOP_MAYBE_EXIT",
+    "BUBBLE_UP",
+};
+
+static bool in_early_exit_macro(clang::SourceLocation loc, const clang::SourceManager& sm, const clang::LangOptions& lo)
+{
+    while (loc.isMacroID()) {
+        const auto name = clang::Lexer::getImmediateMacroName(loc, sm, lo);
+        if (llvm::is_contained(g_early_exit_macros, name)) {
+            return true;
         }
-        auto user_diag = diag(decl->getBeginLoc(), "%0 should return MaybeEarlyExit.") << decl;
-        recursiveChangeType(decl, user_diag);
+        loc = sm.getImmediateMacroCallerLoc(loc);
+    }
+    return false;
+}
+
+// Everything that needs rewriting in a single function body.
+struct EarlyExitSites {
+    struct IfNotSite {
+        const clang::IfStmt* stmt;
+        llvm::SmallVector<const clang::UnaryOperator*, 1> nots;
+    };
+    struct AssignSite {
+        clang::SourceLocation begin;
+        clang::SourceLocation op;
+        clang::SourceLocation end;
+    };
+    struct DeclSite {
+        const clang::DeclStmt* stmt;
+        const clang::VarDecl* var;
+        const clang::CallExpr* call;
+    };
+
+    // Directly calls ShutdownRequested/StartShutdown or an early-exit function.
+    bool calls_early_exit{false};
+    llvm::SmallVector<const clang::CallExpr*, 16> calls;
+    llvm::SmallVector<const clang::ReturnStmt*, 4> naked_returns;
+    llvm::SmallVector<const clang::IfStmt*, 4> if_sites;
+    llvm::SmallVector<IfNotSite, 4> if_not_sites;
+    llvm::SmallVector<AssignSite, 4> assign_sites;
+    llvm::SmallVector<DeclSite, 4> decl_sites;
+    llvm::SmallVector<const clang::CallExpr*, 4> bubble_sites;
+    llvm::SmallVector<const clang::CallExpr*, 4> unused_sites;
+    llvm::SmallVector<const clang::FunctionDecl*, 2> lambdas;
+};
+
+// Walks a function body exactly once and sorts every early-exit call into
+// the rewrite it needs. Statements are visited before their children, so the
+// enclosing if/decl/assignment/return claims a call before it can be treated
+// as unused. Lambdas and local classes are left to their own walk, like
+// forCallable() would.
+class EarlyExitVisitor : public clang::RecursiveASTVisitor<EarlyExitVisitor>
+{
+public:
+    EarlyExitVisitor(const clang::ASTContext& ctx, llvm::function_ref<bool(const clang::CallExpr*)> is_early_exit)
+        : m_sm(ctx.getSourceManager()), m_lo(ctx.getLangOpts()), m_is_early_exit(is_early_exit) {}
+
+    EarlyExitSites sites;
+
+    bool TraverseLambdaExpr(clang::LambdaExpr* lambda)
+    {
+        sites.lambdas.push_back(lambda->getCallOperator());
+        return true;
     }
-    if (const auto *body = Result.Nodes.getNodeAs<clang::Stmt>("stmt_needs_return"))
+
+    bool TraverseCXXRecordDecl(clang::CXXRecordDecl*)
     {
-        auto user_diag = diag(body->getEndLoc(), " now needs return statement.");
-        addReturn(body, user_diag, sm);
+        return true;
     }
-    if (const auto* stmt = Result.Nodes.getNodeAs<clang::ReturnStmt>("naked_return"))
+
+    bool VisitIfStmt(clang::IfStmt* stmt)
     {
-        auto user_diag = diag(stmt->getBeginLoc(), "Should return something.");
-        updateReturn(stmt, user_diag);
+        const auto* cond = stmt->getCond();
+        if (!cond || inMacro(stmt->getBeginLoc())) {
+            return true;
+        }
+        llvm::SmallVector<const clang::CallExpr*, 2> calls;
+        llvm::SmallVector<const clang::UnaryOperator*, 1> nots;
+        scanCondition(cond, calls, nots);
+        if (calls.empty()) {
+            return true;
+        }
+        m_claimed.insert(calls.begin(), calls.end());
+        if (nots.empty()) {
+            sites.if_sites.push_back(stmt);
+        } else {
+            sites.if_not_sites.push_back({stmt, std::move(nots)});
+        }
+        return true;
     }
-    if (const auto* expr = Result.Nodes.getNodeAs<clang::IfStmt>("conditional_early_exit"))
+
+    bool VisitDeclStmt(clang::DeclStmt* stmt)
     {
-        if (const auto* callexpr = Result.Nodes.getNodeAs<clang::CallExpr>("if_call_expr")) {
-            if(!g_calls.insert(callexpr->getID(*Result.Context)).second) {
-                return;
+        if (inMacro(stmt->getBeginLoc())) {
+            return true;
+        }
+        for (const auto* decl : stmt->decls()) {
+            const auto* var = llvm::dyn_cast<clang::VarDecl>(decl);
+            if (!var || !var->getInit()) {
+                continue;
+            }
+            if (const auto* call = claimSpelled(var->getInit())) {
+                sites.decl_sites.push_back({stmt, var, call});
+                break;
             }
         }
-        auto beginLoc = expr->getIfLoc();
-        auto endLoc = expr->getLParenLoc();
-        clang::SourceRange range = {beginLoc, endLoc};
-        const auto user_diag = diag(beginLoc, "Adding Macros");
-        user_diag << clang::FixItHint::CreateReplacement(range, "EXIT_OR_IF(");
-        // TODO: Maybe filter more?
-        // TODO: "if (early_exit_call() == foo)"    -> "if (*early_exit_call() == foo)"
-        // TODO: "auto foo = early_exit_call().bar" -> "auto foo = early_exit_call()->bar"
+        return true;
     }
-    if (const auto* expr = Result.Nodes.getNodeAs<clang::UnaryOperator>("not_operator"))
+
+    bool VisitBinaryOperator(clang::BinaryOperator* op)
     {
-        auto beginLoc = expr->getOperatorLoc();
-        auto endLoc = expr->getExprLoc();
-        clang::SourceRange range = {beginLoc, endLoc};
-        const auto user_diag = diag(beginLoc, "Adding Macros");
-        user_diag << clang::FixItHint::CreateRemoval(range);
+        if (op->isAssignmentOp() && claimSpelled(op->getRHS())) {
+            sites.assign_sites.push_back({op->getBeginLoc(), op->getOperatorLoc(), op->getEndLoc()});
+        }
+        return true;
     }
-    if (const auto* expr = Result.Nodes.getNodeAs<clang::IfStmt>("conditional_not_early_exit"))
+
+    bool VisitReturnStmt(clang::ReturnStmt* stmt)
     {
-        if (const auto* callexpr = Result.Nodes.getNodeAs<clang::CallExpr>("if_not_call_expr")) {
-            if(!g_calls.insert(callexpr->getID(*Result.Context)).second) {
-                return;
-            }
+        const auto* value = stmt->getRetValue();
+        if (!value) {
+            sites.naked_returns.push_back(stmt);
+        } else if (const auto* call = claimSpelled(value)) {
+            sites.bubble_sites.push_back(call);
         }
-        auto beginLoc = expr->getIfLoc();
-        auto endLoc = expr->getLParenLoc();
-        clang::SourceRange range = {beginLoc, endLoc};
-        const auto user_diag = diag(beginLoc, "Adding Macros");
-        user_diag << clang::FixItHint::CreateReplacement(range, "EXIT_OR_IF_NOT(");
+        return true;
     }
 
-    if (const auto* bin = Result.Nodes.getNodeAs<clang::CXXOperatorCallExpr>("early_exit_assignment"))
+    bool VisitCallExpr(clang::CallExpr* call)
     {
-        // TODO: de-dupe with binaryOperator
-        if (const auto* callexpr = Result.Nodes.getNodeAs<clang::CallExpr>("assign_call_expr")) {
-            if(!g_calls.insert(callexpr->getID(*Result.Context)).second) {
-                return;
+        if (const auto* op = llvm::dyn_cast<clang::CXXOperatorCallExpr>(call)) {
+            if (op->isAssignmentOp() && op->getNumArgs() == 2 && claimSpelled(op->getArg(1))) {
+                sites.assign_sites.push_back({op->getBeginLoc(), op->getOperatorLoc(), op->getEndLoc()});
             }
         }
-        const auto user_diag = diag(bin->getBeginLoc(), "Adding Macros");
-        user_diag << clang::FixItHint::CreateInsertion(bin->getBeginLoc(), "EXIT_OR_ASSIGN(");
+        sites.calls.push_back(call);
+        const bool early_exit = m_is_early_exit(call);
+        if (early_exit) {
+            sites.calls_early_exit = true;
+        } else if (const auto* callee = call->getDirectCallee(); callee && is_shutdown_root(callee)) {
+            sites.calls_early_exit = true;
+        }
+        if (early_exit && !m_claimed.count(call) && !inMacro(call->getBeginLoc())) {
+            sites.unused_sites.push_back(call);
+        }
+        return true;
+    }
 
-        const auto& beginLoc = bin->getOperatorLoc();
-        const auto& endLoc = bin->getExprLoc();
-        clang::SourceRange range = {beginLoc, endLoc};
-        user_diag << clang::FixItHint::CreateReplacement(range, ",");
+private:
+    bool inMacro(clang::SourceLocation loc) const
+    {
+        return in_early_exit_macro(loc, m_sm, m_lo);
+    }
 
-        user_diag << clang::FixItHint::CreateInsertion(bin->getEndLoc(), ")");
+    // Claims the early-exit call spelled as expr, if any.
+    const clang::CallExpr* claimSpelled(const clang::Expr* expr)
+    {
+        const auto* call = llvm::dyn_cast<clang::CallExpr>(expr->IgnoreUnlessSpelledInSource());
+        if (!call || !m_is_early_exit(call) || inMacro(call->getBeginLoc())) {
+            return nullptr;
+        }
+        if (!m_claimed.insert(call).second) {
+            return nullptr;
+        }
+        return call;
     }
 
-    if (const auto* bin = Result.Nodes.getNodeAs<clang::BinaryOperator>("early_exit_assignment"))
+    // Collects the early-exit calls in an if condition, along with every "!"
+    // that has one of them underneath. Returns whether stmt contains any.
+    bool scanCondition(const clang::Stmt* stmt, llvm::SmallVectorImpl<const clang::CallExpr*>& calls, llvm::SmallVectorImpl<const clang::UnaryOperator*>& nots)
     {
-        if (const auto* callexpr = Result.Nodes.getNodeAs<clang::CallExpr>("assign_call_expr")) {
-            if(!g_calls.insert(callexpr->getID(*Result.Context)).second) {
-                return;
+        bool found = false;
+        for (const auto* child : stmt->children()) {
+            if (child && !llvm::isa<clang::LambdaExpr>(child)) {
+                found |= scanCondition(child, calls, nots);
             }
         }
-        const auto user_diag = diag(bin->getBeginLoc(), "Adding Macros");
-        user_diag << clang::FixItHint::CreateInsertion(bin->getBeginLoc(), "EXIT_OR_ASSIGN(");
+        if (const auto* call = llvm::dyn_cast<clang::CallExpr>(stmt); call && m_is_early_exit(call)) {
+            calls.push_back(call);
+            found = true;
+        }
+        if (const auto* op = llvm::dyn_cast<clang::UnaryOperator>(stmt); op && found && op->getOpcode() == clang::UO_LNot) {
+            nots.push_back(op);
+        }
+        return found;
+    }
+
+    const clang::SourceManager& m_sm;
+    const clang::LangOptions& m_lo;
+    llvm::function_ref<bool(const clang::CallExpr*)> m_is_early_exit;
+    llvm::SmallPtrSet<const clang::CallExpr*, 8> m_claimed;
+};
+
+} // anonymous namespace
+
+namespace bitcoin {
+
+  PropagateEarlyExitCheck::PropagateEarlyExitCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+      : clang::tidy::ClangTidyCheck(Name, Context),
+        m_summary_dir(Options.get("SummaryDir", "")),
+        m_closure_file(Options.get("EarlyExitClosure", "")),
+        m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)),
+        m_trigger_gate(Name.str(), {"MaybeEarlyExit", "ShutdownRequested", "StartShutdown"}, Options.getLocalOrGlobal("TriggerGate", true) && m_summary_dir.empty())
+  {
+    CheckProfiler::instance().configure(Context);
+    if (m_closure_file.empty()) {
+        return;
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(m_closure_file, /*IsText=*/true);
+    if (!buffer) {
+        llvm::errs() << "bitcoin-propagate-early-exit: unable to read " << m_closure_file << ": " << buffer.getError().message() << "\n";
+        return;
+    }
+    llvm::SmallVector<llvm::StringRef, 0> lines;
+    (*buffer)->getBuffer().split(lines, '\n', -1, false);
+    for (const auto& line : lines) {
+        const auto key = line.trim();
+        if (!key.empty() && !key.startswith("#")) {
+            m_closure.insert(key);
+            m_trigger_gate.addIdentifier(closure_trigger(key), /*Spelled=*/true);
+        }
+    }
+  }
 
-        const auto& beginLoc = bin->getOperatorLoc();
-        const auto& endLoc = bin->getExprLoc();
-        clang::SourceRange range = {beginLoc, endLoc};
-        user_diag << clang::FixItHint::CreateReplacement(range, ",");
+  void PropagateEarlyExitCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) {
+    Options.store(Opts, "SummaryDir", m_summary_dir);
+    Options.store(Opts, "EarlyExitClosure", m_closure_file);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+    Options.store(Opts, "TriggerGate", m_trigger_gate.enabled());
+  }
+
+  void PropagateEarlyExitCheck::registerMatchers(clang::ast_matchers::MatchFinder *Finder) {
+  using namespace clang::ast_matchers;
+    // Every function body is walked exactly once by EarlyExitVisitor, which
+    // collects all rewrite sites (and the call graph in summary mode).
+    Finder->addMatcher(
+      functionDecl(unless(isInSkippedTU(&m_trigger_gate)), unless(isInDoneHeader(&m_header_cache)), isDefinition(), unless(isImplicit())).bind("func")
+    , CheckProfiler::instance().callback(this, "func"));
+  }
 
-        user_diag << clang::FixItHint::CreateInsertion(bin->getEndLoc(), ")");
+  void PropagateEarlyExitCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result) {
+    if (const auto* func = Result.Nodes.getNodeAs<clang::FunctionDecl>("func")) {
+        analyzeFunction(func, *Result.Context);
     }
+  }
 
-    if (const auto* decl = Result.Nodes.getNodeAs<clang::DeclStmt>("declstmt"))
-    {
-        if (const auto* var = Result.Nodes.getNodeAs<clang::VarDecl>("vardecl")) {
-            const auto user_diag = diag(decl->getBeginLoc(), "Adding Macros");
-
-            clang::SourceRange typerange;
-            if (const auto* expr = Result.Nodes.getNodeAs<clang::CallExpr>("callsite")) {
-                if(!g_calls.insert(expr->getID(*Result.Context)).second) {
-                    return;
-                }
-                typerange = {expr->getBeginLoc(), expr->getEndLoc()};
+  bool PropagateEarlyExitCheck::isEarlyExitCall(const clang::CallExpr* call, const clang::SourceManager& sm)
+  {
+    if (is_early_exit_type(call->getType())) {
+        return true;
+    }
+    if (m_closure.empty()) {
+        return false;
+    }
+    const auto* callee = call->getDirectCallee();
+    if (!callee) {
+        return false;
+    }
+    auto [it, inserted] = m_closure_cache.try_emplace(callee->getCanonicalDecl(), false);
+    if (inserted) {
+        it->second = m_closure.count(function_key(callee, sm));
+    }
+    return it->second;
+  }
+
+  void PropagateEarlyExitCheck::analyzeFunction(const clang::FunctionDecl* decl, clang::ASTContext& ctx)
+  {
+    if (!decl->hasBody() || !m_analyzed.insert(decl).second) {
+        return;
+    }
+    const auto& sm = ctx.getSourceManager();
+    const bool summary = !m_summary_dir.empty();
+    // Fix-its belong in the template pattern, not in each instantiation.
+    if (!summary && decl->isTemplateInstantiation()) {
+        return;
+    }
+
+    auto is_early_exit = [&](const clang::CallExpr* call) { return isEarlyExitCall(call, sm); };
+    EarlyExitVisitor visitor(ctx, is_early_exit);
+    visitor.TraverseStmt(decl->getBody());
+    const auto& sites = visitor.sites;
+
+    for (const auto* lambda : sites.lambdas) {
+        analyzeFunction(lambda, ctx);
+    }
+
+    if (summary) {
+        if (m_main_file.empty()) {
+            m_main_file = sm.getFilename(sm.getLocForStartOfFile(sm.getMainFileID())).str();
+        }
+        auto& entry = m_summary[function_key(decl, sm)];
+        entry.returns_early_exit = is_early_exit_type(decl->getReturnType());
+        entry.is_main = decl->isMain();
+        entry.root = sites.calls_early_exit;
+        for (const auto* call : sites.calls) {
+            const auto* callee = call->getDirectCallee();
+            if (callee && !is_shutdown_root(callee) && !is_early_exit_type(call->getType())) {
+                entry.callees.insert(function_key(callee, sm));
             }
+        }
+        return;
+    }
 
-            std::string result = "EXIT_OR_DECL(";
-            const auto& ctx = var->getASTContext();
-            const auto& opts = ctx.getLangOpts();
-            clang::SourceRange varrange = {var->getBeginLoc(), var->getTypeSpecEndLoc()};
-            result += get_source_text(varrange, sm, opts);
-            result += " ";
-            result += var->getQualifiedNameAsString();
-            result += ", ";
-            result += get_source_text(typerange, sm, opts);
-            result += ");";
-            user_diag << clang::FixItHint::CreateReplacement(decl->getSourceRange(), result);
+    CheckProfiler::noteCounter("if_sites", sites.if_sites.size());
+    CheckProfiler::noteCounter("if_not_sites", sites.if_not_sites.size());
+    CheckProfiler::noteCounter("assign_sites", sites.assign_sites.size());
+    CheckProfiler::noteCounter("decl_sites", sites.decl_sites.size());
+    CheckProfiler::noteCounter("unused_sites", sites.unused_sites.size());
+    CheckProfiler::noteCounter("bubble_sites", sites.bubble_sites.size());
+
+    if (sites.calls_early_exit && !decl->isMain() && !is_early_exit_type(decl->getReturnType())) {
+        CheckProfiler::noteCounter("converted_functions");
+        {
+            auto user_diag = diag(decl->getBeginLoc(), "%0 should return MaybeEarlyExit.") << decl;
+            recursiveChangeType(decl, user_diag);
+        }
+        const auto* body = llvm::dyn_cast<clang::CompoundStmt>(decl->getBody());
+        if (body && !body->body_empty() && llvm::none_of(body->body(), [](const clang::Stmt* stmt) { return llvm::isa<clang::ReturnStmt>(stmt); })) {
+            auto user_diag = diag(body->getEndLoc(), " now needs return statement.");
+            addReturn(body, user_diag, sm);
+            CheckProfiler::noteFixIts(1);
         }
     }
 
-    if (const auto* expr = Result.Nodes.getNodeAs<clang::CallExpr>("unused_early_exit"))
-    {
-        if(!g_calls.insert(expr->getID(*Result.Context)).second) {
-            return;
+    if (sites.calls_early_exit) {
+        CheckProfiler::noteCounter("naked_returns", sites.naked_returns.size());
+        for (const auto* stmt : sites.naked_returns) {
+            auto user_diag = diag(stmt->getBeginLoc(), "Should return something.");
+            updateReturn(stmt, user_diag);
+        }
+        CheckProfiler::noteFixIts(sites.naked_returns.size());
+    }
+
+    for (const auto* stmt : sites.if_sites) {
+        clang::SourceRange range = {stmt->getIfLoc(), stmt->getLParenLoc()};
+        const auto user_diag = diag(stmt->getIfLoc(), "Adding Macros");
+        user_diag << clang::FixItHint::CreateReplacement(range, "EXIT_OR_IF(");
+        CheckProfiler::noteFixIts(1);
+        // TODO: Maybe filter more?
+        // TODO: "if (early_exit_call() == foo)"    -> "if (*early_exit_call() == foo)"
+        // TODO: "auto foo = early_exit_call().bar" -> "auto foo = early_exit_call()->bar"
+    }
+
+    for (const auto& site : sites.if_not_sites) {
+        clang::SourceRange range = {site.stmt->getIfLoc(), site.stmt->getLParenLoc()};
+        const auto user_diag = diag(site.stmt->getIfLoc(), "Adding Macros");
+        user_diag << clang::FixItHint::CreateReplacement(range, "EXIT_OR_IF_NOT(");
+        for (const auto* op : site.nots) {
+            user_diag << clang::FixItHint::CreateRemoval(clang::SourceRange{op->getOperatorLoc(), op->getExprLoc()});
         }
+        CheckProfiler::noteFixIts(1 + site.nots.size());
+    }
+
+    for (const auto& site : sites.assign_sites) {
+        const auto user_diag = diag(site.begin, "Adding Macros");
+        user_diag << clang::FixItHint::CreateInsertion(site.begin, "EXIT_OR_ASSIGN(");
+        user_diag << clang::FixItHint::CreateReplacement(clang::SourceRange{site.op, site.op}, ",");
+        user_diag << clang::FixItHint::CreateInsertion(site.end, ")");
+        CheckProfiler::noteFixIts(3);
+    }
+
+    for (const auto& site : sites.decl_sites) {
+        const auto& opts = ctx.getLangOpts();
+        const auto user_diag = diag(site.stmt->getBeginLoc(), "Adding Macros");
+
+        std::string result = "EXIT_OR_DECL(";
+        clang::SourceRange varrange = {site.var->getBeginLoc(), site.var->getTypeSpecEndLoc()};
+        result += get_source_text(varrange, sm, opts);
+        result += " ";
+        result += site.var->getQualifiedNameAsString();
+        result += ", ";
+        result += get_source_text(site.call->getSourceRange(), sm, opts);
+        result += ");";
+        user_diag << clang::FixItHint::CreateReplacement(site.stmt->getSourceRange(), result);
+        CheckProfiler::noteFixIts(1);
+    }
+
+    for (const auto* expr : sites.unused_sites) {
         const auto user_diag = diag(expr->getBeginLoc(), "Adding Macros");
         user_diag << clang::FixItHint::CreateInsertion(expr->getBeginLoc(), "MAYBE_EXIT(");
         user_diag << clang::FixItHint::CreateInsertion(expr->getEndLoc(), ")");
+        CheckProfiler::noteFixIts(2);
     }
 
-    if (const auto* expr = Result.Nodes.getNodeAs<clang::CallExpr>("bubble_up_expr")) {
-        if(!g_calls.insert(expr->getID(*Result.Context)).second) {
-            return;
-        }
+    for (const auto* expr : sites.bubble_sites) {
         const auto user_diag = diag(expr->getBeginLoc(), "Adding Macros");
         user_diag << clang::FixItHint::CreateInsertion(expr->getBeginLoc(), "BUBBLE_UP(");
         user_diag << clang::FixItHint::CreateInsertion(expr->getEndLoc(), ")");
+        CheckProfiler::noteFixIts(2);
+    }
+  }
+
+  void PropagateEarlyExitCheck::writeSummary()
+  {
+    llvm::SmallString<256> path{m_summary_dir};
+    llvm::sys::path::append(path, llvm::sys::path::filename(m_main_file) + "-" + llvm::utohexstr(llvm::xxHash64(m_main_file)) + ".json");
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+        llvm::errs() << "bitcoin-propagate-early-exit: unable to write " << path << ": " << ec.message() << "\n";
+        return;
+    }
+    llvm::json::OStream json(os, 1);
+    json.object([&] {
+        json.attribute("file", m_main_file);
+        json.attributeArray("functions", [&] {
+            for (const auto& func : m_summary) {
+                const auto& entry = func.getValue();
+                json.object([&] {
+                    json.attribute("key", func.getKey());
+                    json.attribute("returns_early_exit", entry.returns_early_exit);
+                    json.attribute("main", entry.is_main);
+                    json.attribute("root", entry.root);
+                    json.attributeArray("callees", [&] {
+                        for (const auto& callee : entry.callees) {
+                            json.value(callee.getKey());
+                        }
+                    });
+                });
+            }
+        });
+    });
+  }
+
+  void PropagateEarlyExitCheck::onEndOfTranslationUnit()
+  {
+    if (!m_summary_dir.empty() && !m_main_file.empty()) {
+        writeSummary();
     }
+    m_summary.clear();
+    m_main_file.clear();
+    m_analyzed.clear();
+    m_closure_cache.clear();
+    m_header_cache.endTranslationUnit();
+    m_trigger_gate.endTranslationUnit();
   }
 
   void PropagateEarlyExitCheck::recursiveChangeType(const clang::FunctionDecl* decl, clang::DiagnosticBuilder& user_diag)
@@ -279,6 +553,7 @@ namespace bitcoin {
             continue;
         }
         user_diag << clang::FixItHint::CreateReplacement(return_range, (llvm::Twine("MaybeEarlyExit<") + retstring + ">").str());
+        CheckProfiler::noteFixIts(1);
     }
     return;
   }
@@ -5,25 +5,68 @@
 #ifndef EARLY_EXIT_TIDY_MODULE_H
 #define EARLY_EXIT_TIDY_MODULE_H
 
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+#include "TriggerGate.h"
+
 #include <clang-tidy/ClangTidyCheck.h>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+
+#include <string>
+
 namespace bitcoin {
 
 class PropagateEarlyExitCheck final : public clang::tidy::ClangTidyCheck {
 
 public:
-  PropagateEarlyExitCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
-      : clang::tidy::ClangTidyCheck(Name, Context) {}
+  PropagateEarlyExitCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
 
   bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
     return LangOpts.CPlusPlus;
   }
   void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
   void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
 private:
+  // Per-function call graph node, written out in summary mode.
+  struct SummaryEntry {
+    bool returns_early_exit{false};
+    bool is_main{false};
+    // Directly calls ShutdownRequested/StartShutdown or something returning MaybeEarlyExit.
+    bool root{false};
+    llvm::StringSet<> callees;
+  };
+
   void recursiveChangeType(const clang::FunctionDecl*, clang::DiagnosticBuilder&);
   void addReturn(const clang::Stmt*, clang::DiagnosticBuilder&, const clang::SourceManager&);
   void updateReturn(const clang::ReturnStmt*, clang::DiagnosticBuilder&);
+  void analyzeFunction(const clang::FunctionDecl*, clang::ASTContext&);
+  bool isEarlyExitCall(const clang::CallExpr*, const clang::SourceManager&);
+  void writeSummary();
+
+  // When set, each TU writes a call graph summary into this directory
+  // instead of emitting diagnostics.
+  const std::string m_summary_dir;
+  // When set, functions listed in this file (as produced by
+  // early-exit-closure.py) are treated as already returning MaybeEarlyExit.
+  const std::string m_closure_file;
+
+  HeaderCache m_header_cache;
+  // Off in summary mode, which needs the call graph of every TU.
+  TriggerGate m_trigger_gate;
+
+  llvm::StringSet<> m_closure;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  llvm::DenseSet<const clang::FunctionDecl*> m_analyzed;
+  llvm::DenseMap<const clang::FunctionDecl*, bool> m_closure_cache;
+  llvm::StringMap<SummaryEntry> m_summary;
+  std::string m_main_file;
 };
 
 } // namespace bitcoin
@@ -20,7 +20,7 @@ void ExportMainCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
     using namespace clang::ast_matchers;
     finder->addMatcher(
       functionDecl(isMain()).bind("mainfunc")
-    , this);
+    , CheckProfiler::instance().callback(this, "mainfunc"));
 }
 
 void ExportMainCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
@@ -5,6 +5,8 @@
 #ifndef EXPORT_MAIN_CHECK_H
 #define EXPORT_MAIN_CHECK_H
 
+#include "CheckProfiler.h"
+
 #include <clang-tidy/ClangTidyCheck.h>
 
 namespace bitcoin {
@@ -13,7 +15,9 @@ class ExportMainCheck final : public clang::tidy::ClangTidyCheck {
 
 public:
   ExportMainCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
-      : clang::tidy::ClangTidyCheck(Name, Context) {}
+      : clang::tidy::ClangTidyCheck(Name, Context) {
+    CheckProfiler::instance().configure(Context);
+  }
 
   bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
     return LangOpts.CPlusPlus;
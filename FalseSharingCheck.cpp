@@ -0,0 +1,200 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "FalseSharingCheck.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Attr.h>
+#include <clang/AST/RecordLayout.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MathExtras.h>
+
+namespace {
+
+static constexpr const char* g_default_atomic_types = "std::atomic;std::atomic_flag";
+static constexpr const char* g_default_mutex_types = "AnnotatedMixin;GlobalMutex;std::mutex;std::recursive_mutex;std::shared_mutex";
+
+// The mutex named by a GUARDED_BY() argument.
+static const clang::NamedDecl* referenced_decl(const clang::Expr* expr)
+{
+    expr = expr->IgnoreParenImpCasts();
+    if (const auto* member = llvm::dyn_cast<clang::MemberExpr>(expr)) {
+        return member->getMemberDecl();
+    }
+    if (const auto* ref = llvm::dyn_cast<clang::DeclRefExpr>(expr)) {
+        return ref->getDecl();
+    }
+    return nullptr;
+}
+
+// Whether the byte ranges [a, a + a_size) and [b, ...), b >= a, may touch the
+// same cache line. Unless the record is aligned to the line size, anything
+// closer than a line may share one.
+static bool may_share(uint64_t a, uint64_t a_size, uint64_t b, uint64_t line_size, bool aligned)
+{
+    const uint64_t a_last = a + std::max<uint64_t>(a_size, 1) - 1;
+    if (b <= a_last) {
+        return true;
+    }
+    return aligned ? a_last / line_size == b / line_size : b - a_last < line_size;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+FalseSharingCheck::FalseSharingCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_atomic_types(Options.get("AtomicTypes", g_default_atomic_types)),
+      m_mutex_types(Options.get("MutexTypes", g_default_mutex_types)),
+      m_cache_line_size(Options.get("CacheLineSize", 64U)),
+      m_alignment(Options.get("Alignment", "std::hardware_destructive_interference_size")),
+      m_separate_atomics(Options.get("SeparateAtomics", false)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void FalseSharingCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "AtomicTypes", m_atomic_types.str());
+    Options.store(Opts, "MutexTypes", m_mutex_types.str());
+    Options.store(Opts, "CacheLineSize", m_cache_line_size);
+    Options.store(Opts, "Alignment", m_alignment);
+    Options.store(Opts, "SeparateAtomics", m_separate_atomics);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void FalseSharingCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    finder->addMatcher(
+      cxxRecordDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isUnion()),
+        unless(isLambda()),
+        unless(classTemplateSpecializationDecl())
+      ).bind("record"),
+    CheckProfiler::instance().callback(this, "record"));
+}
+
+llvm::Optional<FalseSharingCheck::SyncField> FalseSharingCheck::classify(const clang::FieldDecl* field, const clang::ASTContext& ctx) const
+{
+    if (const auto* guarded = field->getAttr<clang::GuardedByAttr>()) {
+        if (const auto* mutex = referenced_decl(guarded->getArg())) {
+            return SyncField{field, mutex->getCanonicalDecl(), Kind::GUARDED};
+        }
+    }
+    const auto type = field->getType();
+    if (m_mutex_types.contains(type, ctx)) {
+        return SyncField{field, field, Kind::MUTEX};
+    }
+    if (m_atomic_types.contains(type, ctx)) {
+        // Which thread writes an atomic isn't known, and the atomics of a
+        // record are often counters updated together by one thread.
+        return SyncField{field, m_separate_atomics ? static_cast<const clang::Decl*>(field) : field->getParent(), Kind::ATOMIC};
+    }
+    return llvm::None;
+}
+
+void FalseSharingCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    const auto* record = Result.Nodes.getNodeAs<clang::CXXRecordDecl>("record");
+    auto& ctx = *Result.Context;
+    if (record->isDependentContext() || record->isInvalidDecl()) {
+        return;
+    }
+    llvm::SmallVector<SyncField, 8> sync;
+    for (const auto* field : record->fields()) {
+        if (auto entry = classify(field, ctx)) sync.push_back(*entry);
+    }
+    if (sync.size() < 2) {
+        return;
+    }
+
+    // Fields are in offset order, so it is enough to compare neighbours.
+    const auto& layout = ctx.getASTRecordLayout(record);
+    const uint64_t line = m_cache_line_size;
+    const auto offset = [&](const clang::FieldDecl* field) -> uint64_t {
+        return ctx.toCharUnitsFromBits(layout.getFieldOffset(field->getFieldIndex())).getQuantity();
+    };
+    const bool aligned = static_cast<uint64_t>(layout.getAlignment().getQuantity()) >= line;
+    llvm::SmallVector<std::pair<const SyncField*, const SyncField*>, 4> conflicts;
+    for (size_t i = 1; i < sync.size(); ++i) {
+        const auto& prev = sync[i - 1];
+        const auto& cur = sync[i];
+        if (prev.group != cur.group && may_share(offset(prev.field), field_layout(prev.field, ctx).size, offset(cur.field), line, aligned)) {
+            conflicts.emplace_back(&prev, &cur);
+        }
+    }
+    if (conflicts.empty()) {
+        return;
+    }
+    CheckProfiler::noteCounter("conflicts", static_cast<unsigned>(conflicts.size()));
+
+    // Align the member that starts each conflicting group to a new line, and
+    // repeat on the new layout until nothing shares a line.
+    llvm::SmallSetVector<const clang::FieldDecl*, 4> padded;
+    uint64_t new_size{0};
+    const bool simulated = has_sequential_layout(record);
+    if (simulated) {
+        llvm::SmallVector<const clang::FieldDecl*, 16> fields(record->field_begin(), record->field_end());
+        llvm::DenseMap<const clang::FieldDecl*, uint64_t> offsets;
+        while (true) {
+            uint64_t end = ctx.toCharUnitsFromBits(layout.getFieldOffset(0)).getQuantity();
+            for (const auto* field : fields) {
+                const auto info = field_layout(field, ctx);
+                end = llvm::alignTo(end, padded.count(field) ? std::max<uint64_t>(info.align, line) : info.align);
+                offsets[field] = end;
+                end += info.size;
+            }
+            const uint64_t align = padded.empty() ? layout.getAlignment().getQuantity() : std::max<uint64_t>(layout.getAlignment().getQuantity(), line);
+            new_size = llvm::alignTo(end, align);
+            const SyncField* next{nullptr};
+            for (size_t i = 1; i < sync.size() && !next; ++i) {
+                const auto& prev = sync[i - 1];
+                if (prev.group != sync[i].group && may_share(offsets[prev.field], field_layout(prev.field, ctx).size, offsets[sync[i].field], line, align >= line)) {
+                    next = &sync[i];
+                }
+            }
+            if (!next || !padded.insert(next->field)) {
+                break;
+            }
+        }
+    } else {
+        for (const auto& [prev, cur] : conflicts) {
+            padded.insert(cur->field);
+        }
+    }
+
+    {
+        const uint64_t size = layout.getSize().getQuantity();
+        auto user_diag = diag(record->getLocation(), "%0 has members synchronized independently of each other that may share a %1 byte cache line%select{|; padding them grows it from %3 to %4 bytes}2")
+            << record << m_cache_line_size << simulated << static_cast<unsigned>(size) << static_cast<unsigned>(new_size);
+        const bool spelled = llvm::none_of(padded, [](const clang::FieldDecl* field) {
+            return field->getBeginLoc().isMacroID();
+        });
+        if (spelled) {
+            for (const auto* field : padded) {
+                user_diag << clang::FixItHint::CreateInsertion(field->getBeginLoc(), "alignas(" + m_alignment + ") ");
+            }
+            CheckProfiler::noteFixIts(padded.size());
+        }
+    }
+    for (const auto& [prev, cur] : conflicts) {
+        const auto* guard = llvm::dyn_cast<clang::NamedDecl>(cur->group);
+        diag(cur->field->getLocation(), "%0 (%select{an atomic|a mutex|guarded by %3}1) may share a cache line with %2", clang::DiagnosticIDs::Note)
+            << cur->field << static_cast<unsigned>(cur->kind) << prev->field << (guard ? guard : cur->field);
+    }
+}
+
+} // namespace bitcoin
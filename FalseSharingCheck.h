@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FALSESHARING_CHECK_H
+#define FALSESHARING_CHECK_H
+
+#include "CheckProfiler.h"
+#include "CheckUtils.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/Optional.h>
+
+#include <string>
+
+namespace bitcoin {
+
+// Flags records where members that are synchronized independently of each
+// other may share a cache line: mutexes (MutexTypes), GUARDED_BY members of
+// different mutexes, and the record's atomics (AtomicTypes), which form one
+// group unless SeparateAtomics is set. The fix-it aligns each such member that
+// starts a new group to the destructive interference size.
+class FalseSharingCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  FalseSharingCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  enum class Kind { ATOMIC, MUTEX, GUARDED };
+  struct SyncField {
+    const clang::FieldDecl* field;
+    // The mutex guarding the field, or the field itself.
+    const clang::Decl* group;
+    Kind kind;
+  };
+
+  // Whether field is written independently of the other members, and by
+  // what.
+  llvm::Optional<SyncField> classify(const clang::FieldDecl* field, const clang::ASTContext& ctx) const;
+
+  const TypeList m_atomic_types;
+  const TypeList m_mutex_types;
+  const unsigned m_cache_line_size;
+  const std::string m_alignment;
+  const bool m_separate_atomics;
+  HeaderCache m_header_cache;
+};
+
+} // namespace bitcoin
+
+#endif // FALSESHARING_CHECK_H
@@ -0,0 +1,87 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/xxhash.h>
+
+namespace {
+
+// Shared by all checks, the keys include the check name.
+llvm::StringSet<>& done_headers()
+{
+  static llvm::StringSet<> headers;
+  return headers;
+}
+
+// The stored options are keyed by "<check name>.<option>", so this covers the
+// name too.
+std::string options_key(clang::tidy::ClangTidyCheck& check)
+{
+  clang::tidy::ClangTidyOptions::OptionMap options;
+  check.storeOptions(options);
+  llvm::SmallVector<llvm::StringRef, 8> names;
+  for (const auto& option : options) {
+    names.push_back(option.getKey());
+  }
+  llvm::sort(names);
+  std::string key;
+  for (const auto name : names) {
+    key += name.str() + "=" + options.lookup(name).Value + ";";
+  }
+  return key;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+bool HeaderCache::isDone(clang::SourceLocation Loc, const clang::SourceManager& SM)
+{
+  if (!m_enabled || Loc.isInvalid()) {
+    return false;
+  }
+  if (m_sm != &SM) {
+    // A new TU started without us being told, don't trust the FileIDs.
+    m_files.clear();
+    m_sm = &SM;
+  }
+  const auto fid = SM.getFileID(SM.getExpansionLoc(Loc));
+  if (fid == SM.getMainFileID()) {
+    return false;
+  }
+  auto [it, inserted] = m_files.try_emplace(fid);
+  auto& state = it->second;
+  if (inserted) {
+    if (m_key.empty()) {
+      m_key = options_key(m_check);
+    }
+    const auto* entry = SM.getFileEntryForID(fid);
+    if (!entry) {
+      return false;
+    }
+    state.key = m_key + "|" + entry->getName().str() + "|" + llvm::utohexstr(llvm::xxHash64(SM.getBufferData(fid)));
+    state.done = done_headers().count(state.key);
+  }
+  return state.done;
+}
+
+void HeaderCache::endTranslationUnit()
+{
+  for (const auto& file : m_files) {
+    if (!file.second.key.empty()) {
+      done_headers().insert(file.second.key);
+    }
+  }
+  m_files.clear();
+  m_sm = nullptr;
+}
+
+} // namespace bitcoin
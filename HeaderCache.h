@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef HEADER_CACHE_H
+#define HEADER_CACHE_H
+
+#include <clang/ASTMatchers/ASTMatchers.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <llvm/ADT/DenseMap.h>
+
+#include <string>
+
+namespace clang::tidy {
+class ClangTidyCheck;
+} // namespace clang::tidy
+
+namespace bitcoin {
+
+// Remembers which headers a check has already processed during this run.
+//
+// Once a TU finishes, every header that was looked up in it is marked as done
+// for this check, keyed by (path, content hash, check name and options). Later
+// TUs in the same clang-tidy process skip matching inside those headers, since
+// their diagnostics have already been reported.
+//
+// The check name and options come from the check's storeOptions(), so a check
+// configured differently in another run never reuses these results.
+//
+// Headers whose meaning depends on the including TU (different macros defined
+// before inclusion) are not told apart, so checks can turn this off with their
+// HeaderCache option.
+class HeaderCache {
+public:
+  HeaderCache(clang::tidy::ClangTidyCheck& Check, bool Enabled) : m_check(Check), m_enabled(Enabled) {}
+
+  bool enabled() const { return m_enabled; }
+
+  // Whether Loc lies in a header that an earlier TU already processed.
+  bool isDone(clang::SourceLocation Loc, const clang::SourceManager& SM);
+
+  // Marks every header looked up during the finished TU as done.
+  void endTranslationUnit();
+
+private:
+  struct FileState {
+    std::string key;
+    bool done{false};
+  };
+
+  clang::tidy::ClangTidyCheck& m_check;
+  const bool m_enabled;
+  // The check's serialized options, built on first use as the check isn't
+  // fully constructed yet when the cache is.
+  std::string m_key;
+  const clang::SourceManager* m_sm{nullptr};
+  llvm::DenseMap<clang::FileID, FileState> m_files;
+};
+
+// Matches nodes located in a header that was already processed by an earlier
+// TU. Put it first so the rest of the matcher is skipped for those nodes.
+AST_POLYMORPHIC_MATCHER_P(isInDoneHeader, AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl, clang::Stmt), HeaderCache*, cache) {
+  return cache->isDone(Node.getBeginLoc(), Finder->getASTContext().getSourceManager());
+}
+
+} // namespace bitcoin
+
+#endif // HEADER_CACHE_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "HeterogeneousLookupCheck.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/TypeLoc.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+
+namespace {
+
+static bool is_std_string(clang::QualType type)
+{
+    const auto* record = type.getCanonicalType()->getAsCXXRecordDecl();
+    return record && record->isInStdNamespace() && record->getName() == "basic_string";
+}
+
+// Types that std::string can be compared with directly.
+static bool is_string_like(clang::QualType type)
+{
+    type = type.getNonReferenceType().getCanonicalType();
+    if (type->isArrayType() || type->isPointerType()) {
+        return type->getPointeeOrArrayElementType()->isAnyCharacterType();
+    }
+    const auto* record = type->getAsCXXRecordDecl();
+    return record && record->isInStdNamespace() && record->getName() == "basic_string_view";
+}
+
+// The declaration whose written type names the container: the typedef it is
+// spelled with if any, otherwise the variable or field itself. Also returns
+// the written template specialization to add the comparator to.
+static const clang::Decl* container_declaration(const clang::Expr* object, clang::TemplateSpecializationTypeLoc& spec)
+{
+    object = object->IgnoreParenImpCasts();
+    const clang::DeclaratorDecl* decl{nullptr};
+    if (const auto* ref = llvm::dyn_cast<clang::DeclRefExpr>(object)) {
+        decl = llvm::dyn_cast<clang::DeclaratorDecl>(ref->getDecl());
+    } else if (const auto* member = llvm::dyn_cast<clang::MemberExpr>(object)) {
+        decl = llvm::dyn_cast<clang::FieldDecl>(member->getMemberDecl());
+    }
+    if (!decl || !decl->getTypeSourceInfo()) {
+        return nullptr;
+    }
+    const clang::Decl* owner = decl;
+    auto loc = decl->getTypeSourceInfo()->getTypeLoc();
+    while (true) {
+        loc = loc.getUnqualifiedLoc();
+        if (auto ref = loc.getAs<clang::ReferenceTypeLoc>()) {
+            loc = ref.getPointeeLoc();
+        } else if (auto elaborated = loc.getAs<clang::ElaboratedTypeLoc>()) {
+            loc = elaborated.getNamedTypeLoc();
+        } else if (auto typedef_loc = loc.getAs<clang::TypedefTypeLoc>()) {
+            // Changing the typedef covers every declaration using it.
+            const auto* typedef_decl = typedef_loc.getTypedefNameDecl();
+            if (!typedef_decl->getTypeSourceInfo()) {
+                return nullptr;
+            }
+            owner = typedef_decl;
+            loc = typedef_decl->getTypeSourceInfo()->getTypeLoc();
+        } else {
+            break;
+        }
+    }
+    spec = loc.getAs<clang::TemplateSpecializationTypeLoc>();
+    return spec ? owner : nullptr;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+void HeterogeneousLookupCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    finder->addMatcher(
+      cxxMemberCallExpr(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        callee(cxxMethodDecl(
+          hasAnyName("find", "count", "contains", "lower_bound", "upper_bound", "equal_range"),
+          ofClass(classTemplateSpecializationDecl(hasAnyName(
+            "::std::map", "::std::set", "::std::multimap", "::std::multiset",
+            "::std::unordered_map", "::std::unordered_set", "::std::unordered_multimap", "::std::unordered_multiset")).bind("container")))),
+        hasArgument(0, ignoringImplicit(cxxConstructExpr(
+          unless(cxxTemporaryObjectExpr()),
+          hasDeclaration(cxxConstructorDecl(unless(isCopyConstructor()), unless(isMoveConstructor())))).bind("conversion")))
+      ).bind("lookup"),
+    CheckProfiler::instance().callback(this, "lookup"));
+}
+
+void HeterogeneousLookupCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    const auto* lookup = Result.Nodes.getNodeAs<clang::CXXMemberCallExpr>("lookup");
+    const auto* conversion = Result.Nodes.getNodeAs<clang::CXXConstructExpr>("conversion");
+    const auto* container = Result.Nodes.getNodeAs<clang::ClassTemplateSpecializationDecl>("container");
+    if (conversion->getNumArgs() == 0) {
+        return;
+    }
+    const auto key_type = conversion->getType();
+    const auto arg_type = conversion->getArg(0)->IgnoreParenImpCasts()->getType();
+    const auto name = container->getName();
+    const bool ordered = !name.startswith("unordered_");
+    // Unordered containers only have heterogeneous lookup since C++20.
+    if (!ordered && !Result.Context->getLangOpts().CPlusPlus20) {
+        return;
+    }
+
+    CheckProfiler::noteCounter("lookups");
+    const clang::Decl* decl{nullptr};
+    {
+        auto user_diag = diag(lookup->getExprLoc(), "%0 converts its %1 argument to a temporary %2 key, use a transparent %select{hasher and key_equal|comparator}3");
+        user_diag << lookup->getMethodDecl() << arg_type << key_type << ordered;
+
+        // The standard library has no transparent hasher to suggest for
+        // unordered containers. Without a comparison between the two types
+        // std::less<> would not compile.
+        if (!ordered || !is_std_string(key_type) || !is_string_like(arg_type)) {
+            return;
+        }
+        clang::TemplateSpecializationTypeLoc spec;
+        decl = container_declaration(lookup->getImplicitObjectArgument(), spec);
+        // Only add the comparator where the default std::less<Key> is used.
+        const unsigned default_args = name.endswith("map") ? 2 : 1;
+        if (!decl || spec.getNumArgs() != default_args || spec.getRAngleLoc().isMacroID() || !m_fixed.insert(decl).second) {
+            return;
+        }
+        if (llvm::isa<clang::TypedefNameDecl>(decl)) {
+            user_diag << clang::FixItHint::CreateInsertion(spec.getRAngleLoc(), ", std::less<>");
+            CheckProfiler::noteFixIts(1);
+            return;
+        }
+        // Changing the type of a variable or field breaks the declarations
+        // it is passed to or copied from, which only a typedef covers.
+        CheckProfiler::noteCounter("no_typedef");
+    }
+    diag(decl->getLocation(), "declare it with std::less<> here; this changes its type, so every declaration it is passed to or "
+                              "copied from must change too, or use a typedef", clang::DiagnosticIDs::Note);
+}
+
+void HeterogeneousLookupCheck::onEndOfTranslationUnit()
+{
+    m_fixed.clear();
+    m_header_cache.endTranslationUnit();
+}
+
+} // namespace bitcoin
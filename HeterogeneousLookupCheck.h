@@ -0,0 +1,52 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef HETEROGENEOUSLOOKUP_CHECK_H
+#define HETEROGENEOUSLOOKUP_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/DenseSet.h>
+
+namespace bitcoin {
+
+// Finds lookups (find/count/contains/...) into std associative containers
+// whose argument is implicitly converted to the key type, building a
+// temporary key on every call. For ordered containers of std::string the
+// typedef the container is spelled with gets a std::less<> comparator so the
+// lookup happens without the conversion. Containers declared without one only
+// get a note, as changing their type breaks other declarations of it.
+// Unordered containers need a transparent hasher and key_equal, and are only
+// reported in C++20, which added heterogeneous lookup for them.
+class HeterogeneousLookupCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  HeterogeneousLookupCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+      : clang::tidy::ClangTidyCheck(Name, Context),
+        m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)) {
+    CheckProfiler::instance().configure(Context);
+  }
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus14;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override {
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+  }
+private:
+  HeaderCache m_header_cache;
+
+  // Declarations that already got the fix-it in this TU.
+  llvm::DenseSet<const clang::Decl*> m_fixed;
+};
+
+} // namespace bitcoin
+
+#endif // HETEROGENEOUSLOOKUP_CHECK_H
@@ -0,0 +1,87 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef INCLUDECOST_CHECK_H
+#define INCLUDECOST_CHECK_H
+
+#include "CheckProfiler.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Ranks the includes of each main file by what they cost to parse (tokens,
+// bytes and files lexed because of them) and reports the ones that could go:
+// headers none of whose declarations or macros are used by the main file or
+// by the other includes, and headers that are only needed for pointers or
+// references to their classes, which a forward declaration provides.
+//
+// Attribution needs every reference in the TU, so unlike the other checks
+// this one can't skip headers already seen by an earlier TU (HeaderCache),
+// and it is considerably slower. Run it on its own.
+class IncludeCostCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  IncludeCostCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerPPCallbacks(const clang::SourceManager &SM, clang::Preprocessor *PP, clang::Preprocessor *ModuleExpanderPP) override;
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  class Recorder;
+  friend class Recorder;
+
+  // An #include directive of the main file.
+  struct Include {
+    clang::SourceLocation hash_loc;
+    std::string name;
+    const clang::FileEntry* file;
+    bool keep;
+    // Something other than forward declarations is used from it.
+    bool needed{false};
+    // Classes only used through pointers and references.
+    llvm::SetVector<const clang::CXXRecordDecl*> forward;
+    // What was lexed because of it, including nested includes.
+    unsigned files{0};
+    uint64_t bytes{0};
+    uint64_t tokens{0};
+  };
+
+  static constexpr int MAIN_FILE = -1;
+  static constexpr int UNKNOWN = -2;
+
+  int owner(clang::FileID fid) const;
+  void noteUse(clang::SourceLocation from, const clang::Decl* to, const clang::CXXRecordDecl* forward = nullptr);
+  void noteFileUse(clang::SourceLocation from, clang::FileID to, const clang::CXXRecordDecl* forward = nullptr);
+  void noteType(const clang::TypeLoc& type, clang::ASTContext& ctx);
+  void noteCompleteType(const clang::Expr* expr);
+  uint64_t countTokens(clang::FileID fid, const clang::LangOptions& lo);
+
+  const std::vector<std::string> m_keep_includes;
+  const bool m_check_angled_includes;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  const clang::SourceManager* m_sm{nullptr};
+  std::vector<Include> m_includes;
+  // Main file include each entered file was lexed for.
+  llvm::DenseMap<clang::FileID, int> m_owners;
+  // Main file includes by the header they name.
+  llvm::DenseMap<const clang::FileEntry*, llvm::SmallVector<int, 1>> m_by_file;
+};
+
+} // namespace bitcoin
+
+#endif // INCLUDECOST_CHECK_H
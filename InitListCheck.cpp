@@ -19,9 +19,10 @@ void InitListCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
     finder->addMatcher(
      implicitValueInitExpr(
       hasParent(
-       initListExpr(has(designatedInitExpr())).bind("initlist"))
+       // The implicit node itself has no location, check the written list.
+       initListExpr(unless(isInDoneHeader(&m_header_cache)), has(designatedInitExpr())).bind("initlist"))
       ).bind("implicitval")
-    , this);
+    , CheckProfiler::instance().callback(this, "implicitval"));
 }
 
 void InitListCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
@@ -5,6 +5,9 @@
 #ifndef INITLIST_CHECK_H
 #define INITLIST_CHECK_H
 
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
 #include <clang-tidy/ClangTidyCheck.h>
 
 namespace bitcoin {
@@ -13,13 +16,22 @@ class InitListCheck final : public clang::tidy::ClangTidyCheck {
 
 public:
   InitListCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
-      : clang::tidy::ClangTidyCheck(Name, Context) {}
+      : clang::tidy::ClangTidyCheck(Name, Context),
+        m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)) {
+    CheckProfiler::instance().configure(Context);
+  }
 
   bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
     return LangOpts.CPlusPlus;
   }
   void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
   void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override {
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+  }
+private:
+  HeaderCache m_header_cache;
 };
 
 } // namespace bitcoin
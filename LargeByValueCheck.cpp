@@ -0,0 +1,181 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "LargeByValueCheck.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Analysis/Analyses/ExprMutationAnalyzer.h>
+
+#include <llvm/ADT/SmallVector.h>
+
+namespace {
+
+static constexpr const char* g_default_expensive_types =
+    "CBlock;CTransaction;CMutableTransaction;CScript;CScriptWitness;std::vector<unsigned char>";
+// Refcount copies are left to bitcoin-shared-ptr-copy.
+static constexpr const char* g_default_allowed_types = "std::shared_ptr;std::weak_ptr";
+
+} // namespace
+
+namespace bitcoin {
+
+LargeByValueCheck::LargeByValueCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_size_threshold(Options.get("SizeThreshold", 64U)),
+      m_expensive_types(Options.get("ExpensiveTypes", g_default_expensive_types)),
+      m_allowed_types(Options.get("AllowedTypes", g_default_allowed_types)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void LargeByValueCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "SizeThreshold", m_size_threshold);
+    Options.store(Opts, "ExpensiveTypes", m_expensive_types.str());
+    Options.store(Opts, "AllowedTypes", m_allowed_types.str());
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void LargeByValueCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    finder->addMatcher(
+      functionDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isInstantiated()),
+        hasAnyParameter(parmVarDecl(unless(hasType(referenceType())), unless(hasType(pointerType()))))
+      ).bind("func"),
+    CheckProfiler::instance().callback(this, "func"));
+    finder->addMatcher(
+      cxxForRangeStmt(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        hasLoopVariable(varDecl(unless(hasType(referenceType()))).bind("loopvar"))
+      ).bind("forrange"),
+    CheckProfiler::instance().callback(this, "forrange"));
+}
+
+void LargeByValueCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    if (const auto* func = Result.Nodes.getNodeAs<clang::FunctionDecl>("func")) {
+        for (unsigned i = 0; i < func->getNumParams(); ++i) {
+            checkParam(func, i, *Result.Context);
+        }
+    }
+    if (const auto* loop = Result.Nodes.getNodeAs<clang::CXXForRangeStmt>("forrange")) {
+        checkRangeCopy(loop, Result.Nodes.getNodeAs<clang::VarDecl>("loopvar"), *Result.Context);
+    }
+}
+
+std::string LargeByValueCheck::copyCost(clang::QualType type, const clang::ASTContext& ctx) const
+{
+    if (type->isDependentType() || type->isIncompleteType()) {
+        return {};
+    }
+    const auto* record = type->getAsCXXRecordDecl();
+    if (!record || !record->hasDefinition() || record->isInvalidDecl()) {
+        return {};
+    }
+    if (m_allowed_types.contains(type, ctx)) {
+        return {};
+    }
+    if (m_expensive_types.contains(type, ctx)) {
+        return "listed in ExpensiveTypes";
+    }
+    const auto size = ctx.getTypeSizeInChars(type).getQuantity();
+    if (size > m_size_threshold) {
+        return std::to_string(size) + " bytes";
+    }
+    if (record->hasNonTrivialCopyConstructor()) {
+        return "non-trivial copy constructor";
+    }
+    return {};
+}
+
+void LargeByValueCheck::checkParam(const clang::FunctionDecl* func, unsigned index, clang::ASTContext& ctx)
+{
+    const auto* param = func->getParamDecl(index);
+    const auto type = param->getType();
+    if (!func->getBody() || type->isReferenceType() || type->isPointerType() || !param->getIdentifier()) {
+        return;
+    }
+    const auto cost = copyCost(type, ctx);
+    if (cost.empty()) {
+        return;
+    }
+    const auto* method = llvm::dyn_cast<clang::CXXMethodDecl>(func);
+    if (method && (method->isCopyAssignmentOperator() || method->isMoveAssignmentOperator())) {
+        // Copy-and-swap takes its argument by value on purpose.
+        return;
+    }
+
+    const auto uses = find_uses(param, func, ctx);
+    const bool mutated = is_mutated(param, func, ctx);
+    // Moving from a const parameter copies it anyway.
+    const bool movable = !type.isConstQualified();
+    for (const auto* use : uses) {
+        if (movable && is_std_move_arg(use, ctx)) {
+            // Already a sink parameter.
+            return;
+        }
+    }
+    CheckProfiler::noteCounter("params");
+
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+    auto user_diag = diag(param->getLocation(), "%0 is passed by value but is expensive to copy (%1)");
+    user_diag << param << cost;
+
+    if (method && method->isVirtual()) {
+        // Changing the signature would break overrides in other TUs.
+        return;
+    }
+    if (movable && uses.size() == 1 && is_copy_source(uses[0], ctx) && !enclosing_loop(uses[0], ctx)) {
+        // The only use copies it somewhere else: let callers move into it.
+        if (add_std_move(uses[0], user_diag, sm, lo)) {
+            CheckProfiler::noteFixIts(1);
+        }
+        return;
+    }
+    if (mutated) {
+        return;
+    }
+    for (const auto* redecl : func->redecls()) {
+        if (index < redecl->getNumParams() && make_const_ref(redecl->getParamDecl(index), user_diag, sm, lo)) {
+            CheckProfiler::noteFixIts(1);
+        }
+    }
+}
+
+void LargeByValueCheck::checkRangeCopy(const clang::CXXForRangeStmt* loop, const clang::VarDecl* var, clang::ASTContext& ctx)
+{
+    const auto cost = copyCost(var->getType(), ctx);
+    if (cost.empty()) {
+        return;
+    }
+    // Only element copies, not values produced by a proxy iterator.
+    const auto* init = var->getInit();
+    const auto* construct = init ? llvm::dyn_cast<clang::CXXConstructExpr>(init->IgnoreImplicit()) : nullptr;
+    if (!construct || !construct->getConstructor()->isCopyConstructor()) {
+        return;
+    }
+    if (clang::ExprMutationAnalyzer(*loop->getBody(), ctx).isMutated(var)) {
+        // The loop works on its own copy.
+        return;
+    }
+    CheckProfiler::noteCounter("range_copies");
+    auto user_diag = diag(var->getLocation(), "%0 copies each element but is expensive to copy (%1)");
+    user_diag << var << cost;
+    if (make_const_ref(var, user_diag, ctx.getSourceManager(), ctx.getLangOpts())) {
+        CheckProfiler::noteFixIts(1);
+    }
+}
+
+} // namespace bitcoin
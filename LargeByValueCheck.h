@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LARGEBYVALUE_CHECK_H
+#define LARGEBYVALUE_CHECK_H
+
+#include "CheckProfiler.h"
+#include "CheckUtils.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+namespace bitcoin {
+
+// Flags parameters and range-for variables that deep copy an expensive type:
+// one listed in ExpensiveTypes, larger than SizeThreshold bytes, or with a
+// non-trivial copy constructor. Suggests const& when the copy is never
+// mutated, or std::move when a non-const one is only copied somewhere else.
+class LargeByValueCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  LargeByValueCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  // Why copying type is expensive, or empty if it isn't.
+  std::string copyCost(clang::QualType type, const clang::ASTContext& ctx) const;
+  void checkParam(const clang::FunctionDecl* func, unsigned index, clang::ASTContext& ctx);
+  void checkRangeCopy(const clang::CXXForRangeStmt* loop, const clang::VarDecl* var, clang::ASTContext& ctx);
+
+  const unsigned m_size_threshold;
+  const TypeList m_expensive_types;
+  const TypeList m_allowed_types;
+  HeaderCache m_header_cache;
+};
+
+} // namespace bitcoin
+
+#endif // LARGEBYVALUE_CHECK_H
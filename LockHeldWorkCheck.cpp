@@ -0,0 +1,158 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "LockHeldWorkCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+
+namespace {
+
+static constexpr const char* g_default_lock_types = "UniqueLock;std::unique_lock;std::lock_guard;std::scoped_lock";
+static constexpr const char* g_default_expensive_functions =
+    // File I/O
+    "fopen;fclose;fread;fwrite;fflush;fsync;fdatasync;FileCommit;DirectoryCommit;TruncateFile;RenameOver;"
+    // Logging
+    "LogPrintf_;"
+    // Hashing
+    "GetHash;GetWitnessHash;SerializeHash;CSHA256::Write;CSHA256::Finalize;CHash256::Write;CHash256::Finalize;"
+    // Serialization and formatting
+    "Serialize;Unserialize;GetSerializeSize;HexStr;strprintf";
+
+// The mutex expression a lock guard was constructed from, looking through
+// Core's MaybeCheckNotHeld() wrapper.
+static const clang::Expr* locked_mutex(const clang::VarDecl* lock)
+{
+    const auto* init = lock->getInit();
+    const auto* construct = init ? llvm::dyn_cast<clang::CXXConstructExpr>(init->IgnoreImplicit()) : nullptr;
+    if (!construct || construct->getNumArgs() == 0) {
+        return nullptr;
+    }
+    const auto* mutex = construct->getArg(0)->IgnoreParenImpCasts();
+    if (const auto* call = llvm::dyn_cast<clang::CallExpr>(mutex); call && call->getNumArgs() == 1) {
+        mutex = call->getArg(0)->IgnoreParenImpCasts();
+    }
+    return mutex;
+}
+
+// Whether call is in a lambda body nested in scope, which may run after the
+// lock is released.
+static bool in_nested_lambda(const clang::Stmt* call, const clang::Stmt* scope, clang::ASTContext& ctx)
+{
+    if (call == scope) {
+        return false;
+    }
+    auto node = clang::DynTypedNode::create(*call);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty()) {
+            return false;
+        }
+        node = parents[0];
+        if (node.get<clang::LambdaExpr>()) {
+            return true;
+        }
+        if (node.get<clang::Stmt>() == scope) {
+            return false;
+        }
+    }
+}
+
+} // namespace
+
+namespace bitcoin {
+
+LockHeldWorkCheck::LockHeldWorkCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_lock_types(parse_list(Options.get("LockTypes", g_default_lock_types))),
+      m_expensive_functions(parse_list(Options.get("ExpensiveFunctions", g_default_expensive_functions))),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void LockHeldWorkCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "LockTypes", join_list(m_lock_types));
+    Options.store(Opts, "ExpensiveFunctions", join_list(m_expensive_functions));
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void LockHeldWorkCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const std::vector<llvm::StringRef> lock_types(m_lock_types.begin(), m_lock_types.end());
+    finder->addMatcher(
+      declStmt(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        hasParent(compoundStmt().bind("scope")),
+        forEach(varDecl(hasLocalStorage(), hasType(hasUnqualifiedDesugaredType(recordType(hasDeclaration(cxxRecordDecl(hasAnyName(lock_types))))))).bind("lock"))
+      ).bind("decl"),
+    CheckProfiler::instance().callback(this, "lock"));
+}
+
+void LockHeldWorkCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    using namespace clang::ast_matchers;
+    const auto* decl = Result.Nodes.getNodeAs<clang::DeclStmt>("decl");
+    const auto* scope = Result.Nodes.getNodeAs<clang::CompoundStmt>("scope");
+    const auto* lock = Result.Nodes.getNodeAs<clang::VarDecl>("lock");
+    auto& ctx = *Result.Context;
+
+    const auto* mutex = locked_mutex(lock);
+    const std::string mutex_name = mutex ? get_source_text(mutex->getSourceRange(), *Result.SourceManager, ctx.getLangOpts()).str() : "";
+    if (mutex_name.empty()) {
+        return;
+    }
+    auto& stats = m_mutexes[mutex_name];
+    if (stats.first_lock.isInvalid()) {
+        stats.first_lock = lock->getLocation();
+    }
+    ++stats.critical_sections;
+
+    // Everything after the guard's declaration up to the end of the block.
+    bool held = false;
+    for (const auto* stmt : scope->body()) {
+        if (stmt == decl) {
+            held = true;
+            continue;
+        }
+        if (!held) {
+            continue;
+        }
+        for (const auto& node : match(findAll(callExpr().bind("call")), *stmt, ctx)) {
+            const auto* call = node.getNodeAs<clang::CallExpr>("call");
+            const auto* callee = call->getDirectCallee();
+            if (!callee || !is_listed_function(callee, m_expensive_functions) || in_nested_lambda(call, stmt, ctx)) {
+                continue;
+            }
+            ++stats.expensive_calls;
+            CheckProfiler::noteCounter(mutex_name);
+            // With nested locks, report each call once, for the outermost one.
+            if (m_reported.insert(call).second) {
+                diag(call->getExprLoc(), "%0 called while holding %1") << callee << mutex_name;
+            }
+        }
+    }
+}
+
+void LockHeldWorkCheck::onEndOfTranslationUnit()
+{
+    for (const auto& [name, stats] : m_mutexes) {
+        if (stats.expensive_calls == 0) {
+            continue;
+        }
+        diag(stats.first_lock, "%0 is held across %1 expensive call(s) in %2 critical section(s) in this translation unit")
+            << name << stats.expensive_calls << stats.critical_sections;
+    }
+    m_mutexes.clear();
+    m_reported.clear();
+    m_header_cache.endTranslationUnit();
+}
+
+} // namespace bitcoin
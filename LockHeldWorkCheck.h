@@ -0,0 +1,56 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOCKHELDWORK_CHECK_H
+#define LOCKHELDWORK_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/MapVector.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Flags calls to known expensive functions (file I/O, logging, hashing,
+// serialization, or anything listed in ExpensiveFunctions) made while a lock
+// taken by LOCK/LOCK2/WITH_LOCK is held. A lock is held from the declaration
+// of its RAII guard (one of LockTypes) to the end of the enclosing block.
+// Per-mutex totals are reported once per TU.
+class LockHeldWorkCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  LockHeldWorkCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  struct MutexStats {
+    clang::SourceLocation first_lock;
+    unsigned critical_sections{0};
+    unsigned expensive_calls{0};
+  };
+
+  const std::vector<std::string> m_lock_types;
+  const std::vector<std::string> m_expensive_functions;
+  HeaderCache m_header_cache;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  llvm::MapVector<std::string, MutexStats> m_mutexes;
+  llvm::DenseSet<const clang::CallExpr*> m_reported;
+};
+
+} // namespace bitcoin
+
+#endif // LOCKHELDWORK_CHECK_H
@@ -3,9 +3,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "LogPrintfCheck.h"
+#include "CheckUtils.h"
 
 #include <clang/AST/ASTContext.h>
 #include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Lex/Lexer.h>
+
+#include <llvm/ADT/STLExtras.h>
+
+#include <algorithm>
 
 
 namespace {
@@ -26,19 +32,80 @@ AST_MATCHER(clang::StringLiteral, unterminated) {
     }
     return true;
 }
+
+// Arguments before the format string are the source location, category and level.
+static constexpr unsigned FIRST_FORMAT_ARG{6};
+
+static constexpr const char* g_default_hashing_functions = "GetHash;GetWitnessHash;SerializeHash;Hash";
+static constexpr const char* g_default_formatting_functions =
+    "HexStr;ToString;GetHex;strprintf;tfm::format;FormatMoney;ScriptToAsmStr;EncodeBase64;EncodeDestination";
+static constexpr const char* g_default_gated_macros = "LogPrint;LogPrintLevel;LogDebug;LogTrace";
+
+// Whether loc was expanded from one of the given macros.
+static bool in_macro(clang::SourceLocation loc, const std::vector<std::string>& macros, const clang::SourceManager& sm, const clang::LangOptions& lo)
+{
+    while (loc.isMacroID()) {
+        const auto name = clang::Lexer::getImmediateMacroName(loc, sm, lo);
+        if (llvm::is_contained(macros, name)) {
+            return true;
+        }
+        loc = sm.getImmediateMacroCallerLoc(loc);
+    }
+    return false;
+}
 } // namespace
 
 namespace bitcoin {
 
+LogPrintfCheck::LogPrintfCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_expensive_arguments(Options.get("ExpensiveArguments", false)),
+      m_hashing_functions(parse_list(Options.get("HashingFunctions", g_default_hashing_functions))),
+      m_formatting_functions(parse_list(Options.get("FormattingFunctions", g_default_formatting_functions))),
+      m_gated_macros(parse_list(Options.get("GatedMacros", g_default_gated_macros))),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)),
+      m_trigger_gate(Name.str(), {"LogPrintf_"}, Options.getLocalOrGlobal("TriggerGate", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void LogPrintfCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "ExpensiveArguments", m_expensive_arguments);
+    Options.store(Opts, "HashingFunctions", join_list(m_hashing_functions));
+    Options.store(Opts, "FormattingFunctions", join_list(m_formatting_functions));
+    Options.store(Opts, "GatedMacros", join_list(m_gated_macros));
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+    Options.store(Opts, "TriggerGate", m_trigger_gate.enabled());
+}
+
+void LogPrintfCheck::onEndOfTranslationUnit()
+{
+    m_header_cache.endTranslationUnit();
+    m_trigger_gate.endTranslationUnit();
+}
+
 void LogPrintfCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
 {
     using namespace clang::ast_matchers;
     finder->addMatcher(
       callExpr(
+        unless(isInSkippedTU(&m_trigger_gate)),
+        unless(isInDoneHeader(&m_header_cache)),
         callee(functionDecl(hasName("LogPrintf_"))),
         hasArgument(5, stringLiteral(unterminated()).bind("logstring"))
       ).bind("logprintf"),
-    this);
+    CheckProfiler::instance().callback(this, "logprintf"));
+    if (m_expensive_arguments) {
+        finder->addMatcher(
+          callExpr(
+            unless(isInSkippedTU(&m_trigger_gate)),
+            unless(isInDoneHeader(&m_header_cache)),
+            callee(functionDecl(hasName("LogPrintf_"))),
+            hasArgument(FIRST_FORMAT_ARG, expr())
+          ).bind("logargs"),
+        CheckProfiler::instance().callback(this, "logargs"));
+    }
 }
 
 void LogPrintfCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
@@ -49,6 +116,73 @@ void LogPrintfCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &
         auto len = lit->getByteLength();
         const auto& loc = lit->getLocationOfByte(len, *Result.SourceManager, ctx.getLangOpts(), ctx.getTargetInfo());
         user_diag << clang::FixItHint::CreateInsertion(loc, "\\n");
+        CheckProfiler::noteFixIts(1);
+    }
+    if (const auto* call = Result.Nodes.getNodeAs<clang::CallExpr>("logargs")) {
+        checkArguments(call, *Result.Context);
+    }
+}
+
+const char* LogPrintfCheck::costName(ArgCost cost)
+{
+    switch (cost) {
+    case ArgCost::CHEAP: return "cheap";
+    case ArgCost::ALLOCATING: return "allocating";
+    case ArgCost::FORMATTING: return "formatting";
+    case ArgCost::HASHING: return "hashing";
+    }
+    return "";
+}
+
+LogPrintfCheck::ArgCost LogPrintfCheck::classifyArgument(const clang::Expr* arg, clang::ASTContext& ctx) const
+{
+    using namespace clang::ast_matchers;
+    auto cost = ArgCost::CHEAP;
+    for (const auto& node : match(findAll(callExpr().bind("call")), *arg, ctx)) {
+        const auto* call = node.getNodeAs<clang::CallExpr>("call");
+        const auto* callee = call->getDirectCallee();
+        if (callee && is_listed_function(callee, m_hashing_functions)) {
+            return ArgCost::HASHING;
+        }
+        if (callee && is_listed_function(callee, m_formatting_functions)) {
+            cost = std::max(cost, ArgCost::FORMATTING);
+            continue;
+        }
+        // Returning a std::string, std::vector etc by value.
+        const auto type = call->getCallReturnType(ctx);
+        if (const auto* record = type->getAsCXXRecordDecl(); record && !type->isReferenceType() && record->hasDefinition() && !record->hasTrivialDestructor()) {
+            cost = std::max(cost, ArgCost::ALLOCATING);
+        }
+    }
+    for (const auto& node : match(findAll(cxxConstructExpr().bind("construct")), *arg, ctx)) {
+        const auto* record = node.getNodeAs<clang::CXXConstructExpr>("construct")->getType()->getAsCXXRecordDecl();
+        if (record && record->hasDefinition() && !record->hasTrivialDestructor()) {
+            cost = std::max(cost, ArgCost::ALLOCATING);
+        }
+    }
+    return cost;
+}
+
+void LogPrintfCheck::checkArguments(const clang::CallExpr* call, clang::ASTContext& ctx)
+{
+    const auto& sm = ctx.getSourceManager();
+    const bool gated = in_macro(call->getBeginLoc(), m_gated_macros, sm, ctx.getLangOpts());
+    const bool in_loop = enclosing_loop(call, ctx) != nullptr;
+    if (gated && !in_loop) {
+        return;
+    }
+    for (unsigned i = FIRST_FORMAT_ARG; i < call->getNumArgs(); ++i) {
+        const auto* arg = call->getArg(i);
+        const auto cost = classifyArgument(arg, ctx);
+        if (cost == ArgCost::CHEAP) {
+            continue;
+        }
+        CheckProfiler::noteCounter(costName(cost));
+        if (in_loop) {
+            diag(arg->getExprLoc(), "Expensive (%0) log argument is evaluated on every loop iteration, log once after the loop or behind a category") << costName(cost);
+        } else {
+            diag(arg->getExprLoc(), "Expensive (%0) log argument is evaluated even when not logged, use a category-gated LogPrint or pass a cheaper value") << costName(cost);
+        }
     }
 }
 }
@@ -5,21 +5,46 @@
 #ifndef LOGPRINTF_CHECK_H
 #define LOGPRINTF_CHECK_H
 
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+#include "TriggerGate.h"
+
 #include <clang-tidy/ClangTidyCheck.h>
 
+#include <string>
+#include <vector>
+
 namespace bitcoin {
 
 class LogPrintfCheck final : public clang::tidy::ClangTidyCheck {
 
 public:
-  LogPrintfCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
-      : clang::tidy::ClangTidyCheck(Name, Context) {}
+  LogPrintfCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
 
   bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
     return LangOpts.CPlusPlus;
   }
   void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
   void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  enum class ArgCost { CHEAP, ALLOCATING, FORMATTING, HASHING };
+
+  static const char* costName(ArgCost cost);
+  ArgCost classifyArgument(const clang::Expr* arg, clang::ASTContext& ctx) const;
+  void checkArguments(const clang::CallExpr* call, clang::ASTContext& ctx);
+
+  // When set, also flag expensive arguments of LogPrintf_ calls that are
+  // evaluated whether or not anything is logged.
+  const bool m_expensive_arguments;
+  const std::vector<std::string> m_hashing_functions;
+  const std::vector<std::string> m_formatting_functions;
+  // Macros that only evaluate their arguments when the category is enabled.
+  const std::vector<std::string> m_gated_macros;
+
+  HeaderCache m_header_cache;
+  TriggerGate m_trigger_gate;
 };
 
 } // namespace bitcoin
@@ -0,0 +1,346 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "MissingMoveCheck.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Analysis/CFG.h>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <memory>
+
+namespace {
+
+static constexpr const char* g_default_movable_types = "std::vector;std::basic_string;std::deque;std::map;std::set;CScript;CScriptWitness";
+static constexpr const char* g_default_insert_functions =
+    "push_back;emplace_back;push_front;emplace_front;push;emplace;emplace_hint;insert;try_emplace;insert_or_assign";
+
+enum Sink : unsigned { BY_VALUE_PARAM, CONTAINER, MEMBER };
+
+// Evaluation order of a function body, from its CFG. Every expression is its
+// own CFG element, so positions are as fine grained as the AST.
+class EvaluationOrder {
+public:
+    struct Position {
+        const clang::CFGBlock* block;
+        unsigned index;
+        bool operator==(const Position& other) const { return block == other.block && index == other.index; }
+    };
+
+    EvaluationOrder(const clang::FunctionDecl* func, clang::ASTContext& ctx) : m_ctx(ctx)
+    {
+        clang::CFG::BuildOptions options;
+        options.setAllAlwaysAdd();
+        m_cfg = clang::CFG::buildCFG(func, func->getBody(), &ctx, options);
+        if (!m_cfg) {
+            return;
+        }
+        for (const auto* block : *m_cfg) {
+            unsigned index{0};
+            for (const auto& elem : *block) {
+                if (const auto stmt = elem.getAs<clang::CFGStmt>()) {
+                    m_positions.try_emplace(stmt->getStmt(), Position{block, index});
+                }
+                ++index;
+            }
+        }
+    }
+
+    bool valid() const { return m_cfg != nullptr; }
+
+    // Where stmt is evaluated, or where the innermost CFG element containing
+    // it is (e.g. sizeof(x) for x).
+    llvm::Optional<Position> position(const clang::Stmt* stmt) const
+    {
+        auto node = clang::DynTypedNode::create(*stmt);
+        while (true) {
+            if (const auto* s = node.get<clang::Stmt>()) {
+                if (const auto it = m_positions.find(s); it != m_positions.end()) {
+                    return it->second;
+                }
+            }
+            const auto parents = m_ctx.getParents(node);
+            if (parents.size() != 1 || !parents[0].get<clang::Stmt>()) {
+                return llvm::None;
+            }
+            node = parents[0];
+        }
+    }
+
+    // Whether any of reads may be evaluated after from, before var is
+    // declared again (by the next iteration of the loop it lives in). This is
+    // the liveness of var right after from.
+    bool readLater(const clang::VarDecl* var, Position from, llvm::ArrayRef<Position> reads) const
+    {
+        llvm::SmallVector<Position, 8> worklist{{from.block, from.index + 1}};
+        llvm::DenseSet<const clang::CFGBlock*> visited;
+        while (!worklist.empty()) {
+            const auto [block, start] = worklist.pop_back_val();
+            bool redeclared{false};
+            for (unsigned i = start; i < block->size() && !redeclared; ++i) {
+                if (llvm::is_contained(reads, Position{block, i})) {
+                    return true;
+                }
+                const auto stmt = (*block)[i].getAs<clang::CFGStmt>();
+                const auto* decl = stmt ? llvm::dyn_cast<clang::DeclStmt>(stmt->getStmt()) : nullptr;
+                redeclared = decl && llvm::is_contained(decl->decls(), var);
+            }
+            if (redeclared) {
+                continue;
+            }
+            for (const auto& succ : block->succs()) {
+                if (const auto* next = succ.getReachableBlock(); next && visited.insert(next).second) {
+                    worklist.push_back({next, 0});
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    clang::ASTContext& m_ctx;
+    std::unique_ptr<clang::CFG> m_cfg;
+    llvm::DenseMap<const clang::Stmt*, Position> m_positions;
+};
+
+// Whether stmt is in a try block, whose handlers the CFG doesn't connect to
+// the calls that may throw.
+static bool in_try_block(const clang::Stmt* stmt, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*stmt);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty() || parents[0].get<clang::FunctionDecl>() || parents[0].get<clang::LambdaExpr>()) {
+            return false;
+        }
+        node = parents[0];
+        if (node.get<clang::CXXTryStmt>()) {
+            return true;
+        }
+    }
+}
+
+static bool captured_by_reference(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx)
+{
+    using namespace clang::ast_matchers;
+    for (const auto& node : match(findAll(lambdaExpr().bind("lambda")), *func->getBody(), ctx)) {
+        for (const auto& capture : node.getNodeAs<clang::LambdaExpr>("lambda")->captures()) {
+            if (capture.capturesVariable() && capture.getCapturedVar() == var && capture.getCaptureKind() == clang::LCK_ByRef) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+MissingMoveCheck::MissingMoveCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_movable_types(Options.get("MovableTypes", g_default_movable_types)),
+      m_insert_functions(parse_list(Options.get("InsertFunctions", g_default_insert_functions))),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void MissingMoveCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "MovableTypes", m_movable_types.str());
+    Options.store(Opts, "InsertFunctions", join_list(m_insert_functions));
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void MissingMoveCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    // The CFG is built once per function, for all its candidates.
+    finder->addMatcher(
+      functionDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isInstantiated()),
+        hasBody(hasDescendant(declRefExpr(to(varDecl(hasLocalStorage(), unless(parmVarDecl()),
+                                                     hasType(hasUnqualifiedDesugaredType(recordType())))))))
+      ).bind("func"),
+    CheckProfiler::instance().callback(this, "func"));
+}
+
+bool MissingMoveCheck::mayAlias(const clang::DeclRefExpr* use, clang::ASTContext& ctx) const
+{
+    // Follow the value of the use up to where it ends up. Copies into
+    // scalars or owning types are independent of the variable; everything
+    // else (references, pointers, iterators, views) must not outlive the full
+    // expression, so storing it or passing it to a callee escapes. Callees
+    // are assumed not to keep references to the variable itself only;
+    // constructors are followed, as they may (Span).
+    const auto owns_value = [&](clang::QualType type) {
+        return type->isArithmeticType() || type->isEnumeralType() || m_movable_types.contains(type, ctx);
+    };
+    const clang::Expr* current = use;
+    while (true) {
+        if (current != use && current->isPRValue() && owns_value(current->getType())) {
+            return false;
+        }
+        const auto parents = ctx.getParents(*current);
+        if (parents.size() != 1) {
+            return true;
+        }
+        if (const auto* parent = parents[0].get<clang::Expr>()) {
+            const clang::Expr* assigned_to{nullptr};
+            if (const auto* op = llvm::dyn_cast<clang::BinaryOperator>(parent); op && op->isAssignmentOp() && op->getRHS() == current) {
+                assigned_to = op->getLHS();
+            } else if (const auto* op = llvm::dyn_cast<clang::CXXOperatorCallExpr>(parent);
+                       op && op->isAssignmentOp() && op->getNumArgs() == 2 && op->getArg(1) == current) {
+                assigned_to = op->getArg(0);
+            }
+            if (assigned_to) {
+                // p = &v, m_it = v.begin(), but not s = v.
+                return !owns_value(assigned_to->getType());
+            }
+            const auto* call = llvm::dyn_cast<clang::CallExpr>(parent);
+            if (call && !llvm::isa<clang::CXXOperatorCallExpr>(call) && current != use && llvm::is_contained(call->arguments(), current)) {
+                // ptrs.push_back(&v), Register(v.data())
+                return true;
+            }
+            current = parent;
+            continue;
+        }
+        if (const auto* stmt = parents[0].get<clang::Stmt>()) {
+            return llvm::isa<clang::ReturnStmt>(stmt);
+        }
+        const auto* range = parents[0].get<clang::VarDecl>();
+        if (!range || !range->isImplicit() || range->getInit() != current) {
+            // Bound to a reference, stored in a view, captured, ...
+            return true;
+        }
+        // The hidden range variable of a range-for over it, which ends with
+        // the loop. The loop variable may still refer to an element.
+        const auto* decl = ctx.getParents(*range).size() == 1 ? ctx.getParents(*range)[0].get<clang::DeclStmt>() : nullptr;
+        const auto* loop = decl && ctx.getParents(*decl).size() == 1 ? ctx.getParents(*decl)[0].get<clang::CXXForRangeStmt>() : nullptr;
+        if (!loop || loop->getRangeStmt() != decl) {
+            return true;
+        }
+        const auto* loop_var = loop->getLoopVariable();
+        if (!loop_var->getType()->isReferenceType()) {
+            return false;
+        }
+        if (llvm::isa<clang::DecompositionDecl>(loop_var)) {
+            return true;
+        }
+        const auto* func = llvm::dyn_cast_or_null<clang::FunctionDecl>(loop_var->getParentFunctionOrMethod());
+        return !func || llvm::any_of(find_uses(loop_var, func, ctx), [&](const auto* loop_use) { return mayAlias(loop_use, ctx); });
+    }
+}
+
+void MissingMoveCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    using namespace clang::ast_matchers;
+    const auto* func = Result.Nodes.getNodeAs<clang::FunctionDecl>("func");
+    auto& ctx = *Result.Context;
+    const auto& sm = *Result.SourceManager;
+    const auto& lo = ctx.getLangOpts();
+    const std::vector<llvm::StringRef> insert_functions(m_insert_functions.begin(), m_insert_functions.end());
+
+    const auto local = ignoringParenImpCasts(declRefExpr(to(varDecl(hasLocalStorage(), unless(parmVarDecl())).bind("var"))).bind("use"));
+    const auto copy = ignoringImplicit(cxxConstructExpr(hasDeclaration(cxxConstructorDecl(isCopyConstructor())), hasArgument(0, local)));
+    const auto by_value_param = parmVarDecl(unless(hasType(referenceType())));
+    const auto sinks = match(findAll(stmt(anyOf(
+        callExpr(forEachArgumentWithParam(copy, by_value_param)).bind("byvalue"),
+        cxxConstructExpr(forEachArgumentWithParam(copy, by_value_param)).bind("byvalue"),
+        cxxMemberCallExpr(callee(cxxMethodDecl(hasAnyName(insert_functions))),
+                          forEachArgumentWithParam(local, parmVarDecl(hasType(lValueReferenceType())).bind("param"))).bind("insert"),
+        cxxOperatorCallExpr(callee(cxxMethodDecl(isCopyAssignmentOperator())),
+                            hasArgument(0, ignoringParenImpCasts(memberExpr())), hasArgument(1, local)).bind("member")))),
+        *func->getBody(), ctx);
+    if (sinks.empty()) {
+        return;
+    }
+
+    std::unique_ptr<EvaluationOrder> order;
+    llvm::SmallPtrSet<const clang::DeclRefExpr*, 8> seen;
+    for (const auto& node : sinks) {
+        const auto* use = node.getNodeAs<clang::DeclRefExpr>("use");
+        const auto* var = node.getNodeAs<clang::VarDecl>("var");
+        if (!seen.insert(use).second || use->refersToEnclosingVariableOrCapture() || var->getParentFunctionOrMethod() != func ||
+            var->getType().isConstQualified() || var->getType().isVolatileQualified() || !m_movable_types.contains(var->getType(), ctx)) {
+            continue;
+        }
+        Sink sink{BY_VALUE_PARAM};
+        if (const auto* call = node.getNodeAs<clang::CXXMemberCallExpr>("insert")) {
+            const auto* param = node.getNodeAs<clang::ParmVarDecl>("param");
+            const auto* callee = call->getMethodDecl();
+            if (!callee || param->getFunctionScopeIndex() >= callee->getNumParams() || !has_rvalue_alternative(callee, param->getFunctionScopeIndex())) {
+                continue;
+            }
+            sink = CONTAINER;
+        } else if (node.getNodeAs<clang::CXXOperatorCallExpr>("member")) {
+            sink = MEMBER;
+        }
+
+        // Aliases and exceptions, which the CFG doesn't model.
+        if (in_try_block(use, ctx) || captured_by_reference(var, func, ctx)) {
+            continue;
+        }
+        const auto uses = find_uses(var, func, ctx);
+        const auto* full = full_expression(use, ctx);
+        const bool unsafe = llvm::any_of(uses, [&](const clang::DeclRefExpr* other) {
+            if (other == use || other->refersToEnclosingVariableOrCapture()) {
+                // Uses inside a lambda body refer to the lambda's own copy.
+                return false;
+            }
+            // Argument evaluation order is unspecified, so another use in
+            // the same full expression may come after the move.
+            const bool same_expression = !sm.isBeforeInTranslationUnit(other->getBeginLoc(), full->getBeginLoc()) &&
+                                         !sm.isBeforeInTranslationUnit(full->getEndLoc(), other->getEndLoc());
+            return same_expression || mayAlias(other, ctx);
+        });
+        if (unsafe) {
+            continue;
+        }
+
+        if (!order) {
+            order = std::make_unique<EvaluationOrder>(func, ctx);
+            CheckProfiler::noteCounter("cfg");
+        }
+        if (!order->valid()) {
+            return;
+        }
+        const auto from = order->position(use);
+        llvm::SmallVector<EvaluationOrder::Position, 8> reads;
+        bool unordered{!from};
+        for (const auto* other : uses) {
+            if (other->refersToEnclosingVariableOrCapture()) continue;
+            if (const auto pos = order->position(other)) {
+                reads.push_back(*pos);
+            } else {
+                unordered = true;
+            }
+        }
+        if (unordered || order->readLater(var, *from, reads)) {
+            continue;
+        }
+
+        CheckProfiler::noteCounter(sink == BY_VALUE_PARAM ? "param" : sink == CONTAINER ? "insert" : "member");
+        auto user_diag = diag(use->getLocation(), "%0 is copied into %select{a by-value parameter|a container|a member}1 on its last use, move it instead");
+        user_diag << var << static_cast<unsigned>(sink);
+        if (add_std_move(use, user_diag, sm, lo)) {
+            CheckProfiler::noteFixIts(1);
+        }
+    }
+}
+
+} // namespace bitcoin
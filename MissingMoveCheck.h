@@ -0,0 +1,47 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MISSINGMOVE_CHECK_H
+#define MISSINGMOVE_CHECK_H
+
+#include "CheckProfiler.h"
+#include "CheckUtils.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Finds locals of an owning type (std::vector, std::string, CScript, ...)
+// that are copied into a by-value parameter, a container or a member on their
+// last use, and moves them instead. Whether a use is the last one is decided
+// on the function's CFG, so the fix-its are safe to apply automatically:
+// loops, aliases and unsequenced uses in the same expression all disqualify
+// a use.
+class MissingMoveCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  MissingMoveCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus11;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  bool mayAlias(const clang::DeclRefExpr* use, clang::ASTContext& ctx) const;
+
+  const TypeList m_movable_types;
+  const std::vector<std::string> m_insert_functions;
+  HeaderCache m_header_cache;
+};
+
+} // namespace bitcoin
+
+#endif // MISSINGMOVE_CHECK_H
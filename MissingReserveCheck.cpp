@@ -0,0 +1,231 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "MissingReserveCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Analysis/Analyses/ExprMutationAnalyzer.h>
+
+#include <llvm/ADT/MapVector.h>
+
+namespace {
+
+// Whether expr can be evaluated again in front of the loop with the same
+// result: names, member accesses and size() calls on them.
+static bool is_simple(const clang::Expr* expr)
+{
+    expr = expr->IgnoreParenImpCasts();
+    if (llvm::isa<clang::DeclRefExpr, clang::CXXThisExpr, clang::IntegerLiteral>(expr)) {
+        return true;
+    }
+    if (const auto* member = llvm::dyn_cast<clang::MemberExpr>(expr)) {
+        return !llvm::isa<clang::CXXMethodDecl>(member->getMemberDecl()) && is_simple(member->getBase());
+    }
+    if (const auto* call = llvm::dyn_cast<clang::CXXMemberCallExpr>(expr)) {
+        const auto* method = call->getMethodDecl();
+        return method && method->getIdentifier() && method->getName() == "size" && call->getNumArgs() == 0 &&
+               is_simple(call->getImplicitObjectArgument());
+    }
+    if (const auto* op = llvm::dyn_cast<clang::UnaryOperator>(expr)) {
+        return op->getOpcode() == clang::UO_Deref && is_simple(op->getSubExpr());
+    }
+    return false;
+}
+
+static bool has_method(clang::QualType type, llvm::StringRef name)
+{
+    const auto* record = type.getNonReferenceType()->getAsCXXRecordDecl();
+    if (!record || !record->hasDefinition()) {
+        return false;
+    }
+    for (const auto* method : record->methods()) {
+        if (method->getIdentifier() && method->getName() == name) return true;
+    }
+    return false;
+}
+
+// Whether stmt runs exactly once per iteration of loop: not nested in a
+// condition, switch, inner loop or lambda.
+static bool runs_every_iteration(const clang::Stmt* stmt, const clang::Stmt* loop, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*stmt);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1) {
+            return false;
+        }
+        node = parents[0];
+        const auto* parent = node.get<clang::Stmt>();
+        if (!parent) {
+            return false;
+        }
+        if (parent == loop) {
+            return true;
+        }
+        if (llvm::isa<clang::IfStmt, clang::SwitchStmt, clang::ConditionalOperator, clang::BinaryConditionalOperator,
+                      clang::ForStmt, clang::WhileStmt, clang::DoStmt, clang::CXXForRangeStmt, clang::LambdaExpr>(parent)) {
+            return false;
+        }
+        if (const auto* op = llvm::dyn_cast<clang::BinaryOperator>(parent); op && op->isLogicalOp()) {
+            return false;
+        }
+    }
+}
+
+} // namespace
+
+namespace bitcoin {
+
+void MissingReserveCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const auto append = cxxMemberCallExpr(callee(cxxMethodDecl(hasAnyName("push_back", "emplace_back"))));
+    finder->addMatcher(
+      stmt(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        anyOf(forStmt(hasBody(hasDescendant(append))), cxxForRangeStmt(hasBody(hasDescendant(append))))
+      ).bind("loop"),
+    CheckProfiler::instance().callback(this, "loop"));
+}
+
+std::string MissingReserveCheck::tripCount(const clang::Stmt* loop, clang::ASTContext& ctx) const
+{
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+    if (const auto* range_for = llvm::dyn_cast<clang::CXXForRangeStmt>(loop)) {
+        const auto* range = range_for->getRangeInit();
+        if (!range || !is_simple(range) || !has_method(range->getType(), "size") || range->getBeginLoc().isMacroID()) {
+            return {};
+        }
+        return (get_source_text(range->getSourceRange(), sm, lo) + ".size()").str();
+    }
+    // for (T i = 0; i < bound; ++i), with i not touched in the body
+    const auto* for_stmt = llvm::dyn_cast<clang::ForStmt>(loop);
+    if (!for_stmt || !for_stmt->getInit() || !for_stmt->getCond() || !for_stmt->getInc() || !for_stmt->getBody()) {
+        return {};
+    }
+    const auto* init = llvm::dyn_cast<clang::DeclStmt>(for_stmt->getInit());
+    const auto* var = init && init->isSingleDecl() ? llvm::dyn_cast<clang::VarDecl>(init->getSingleDecl()) : nullptr;
+    const auto* start = var && var->getInit() ? llvm::dyn_cast<clang::IntegerLiteral>(var->getInit()->IgnoreParenImpCasts()) : nullptr;
+    if (!start || start->getValue() != 0) {
+        return {};
+    }
+    const auto* cond = llvm::dyn_cast<clang::BinaryOperator>(for_stmt->getCond()->IgnoreParenImpCasts());
+    if (!cond || (cond->getOpcode() != clang::BO_LT && cond->getOpcode() != clang::BO_NE)) {
+        return {};
+    }
+    const auto* lhs = llvm::dyn_cast<clang::DeclRefExpr>(cond->getLHS()->IgnoreParenImpCasts());
+    if (!lhs || lhs->getDecl() != var || !is_simple(cond->getRHS()) || cond->getRHS()->getBeginLoc().isMacroID()) {
+        return {};
+    }
+    const auto* inc = llvm::dyn_cast<clang::UnaryOperator>(for_stmt->getInc()->IgnoreParenImpCasts());
+    const auto* inc_var = inc && inc->isIncrementOp() ? llvm::dyn_cast<clang::DeclRefExpr>(inc->getSubExpr()->IgnoreParenImpCasts()) : nullptr;
+    if (!inc_var || inc_var->getDecl() != var) {
+        return {};
+    }
+    if (clang::ExprMutationAnalyzer(*for_stmt->getBody(), ctx).isMutated(var)) {
+        return {};
+    }
+    return get_source_text(cond->getRHS()->getSourceRange(), sm, lo).str();
+}
+
+void MissingReserveCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    using namespace clang::ast_matchers;
+    const auto* loop = Result.Nodes.getNodeAs<clang::Stmt>("loop");
+    auto& ctx = *Result.Context;
+    const auto& sm = *Result.SourceManager;
+    if (loop->getBeginLoc().isMacroID()) {
+        return;
+    }
+    const auto* body = llvm::isa<clang::ForStmt>(loop) ? llvm::cast<clang::ForStmt>(loop)->getBody() : llvm::cast<clang::CXXForRangeStmt>(loop)->getBody();
+
+    // Containers appended to in the body. Only those appended to a fixed
+    // number of times per iteration can be reserved for.
+    struct Appends {
+        const clang::CXXMemberCallExpr* first{nullptr};
+        unsigned count{0};
+        bool every_iteration{true};
+    };
+    llvm::MapVector<const clang::VarDecl*, Appends> appends;
+    for (const auto& node : match(findAll(cxxMemberCallExpr(
+             callee(cxxMethodDecl(hasAnyName("push_back", "emplace_back"))),
+             on(declRefExpr(to(varDecl().bind("container"))))).bind("append")), *body, ctx)) {
+        const auto* call = node.getNodeAs<clang::CXXMemberCallExpr>("append");
+        auto& entry = appends[node.getNodeAs<clang::VarDecl>("container")];
+        if (!entry.first) entry.first = call;
+        ++entry.count;
+        entry.every_iteration = entry.every_iteration && runs_every_iteration(call, loop, ctx);
+    }
+
+    std::string count;
+    for (const auto& [container, entry] : appends) {
+        if (!entry.every_iteration) {
+            continue;
+        }
+        const auto* func = llvm::dyn_cast_or_null<clang::FunctionDecl>(container->getParentFunctionOrMethod());
+        // The container has to exist before the loop, and be able to reserve.
+        if (!func || !func->hasBody() || !sm.isBeforeInTranslationUnit(container->getLocation(), loop->getBeginLoc()) ||
+            !has_method(container->getType(), "reserve") || container->getType().getNonReferenceType().isConstQualified()) {
+            continue;
+        }
+        // Reserving on every iteration of an outer loop would defeat the
+        // geometric growth.
+        if (const auto* outer = enclosing_loop(loop, ctx); outer && sm.isBeforeInTranslationUnit(container->getLocation(), outer->getBeginLoc())) {
+            continue;
+        }
+        // A caller's container may be appended to by every call, e.g. per tx
+        // into a block-wide vector, where reserving size() + n on each call
+        // reallocates to an exact fit every time. Only the caller can reserve.
+        const bool callers = llvm::isa<clang::ParmVarDecl>(container) || container->getType()->isReferenceType();
+        // Any use before the loop may add elements or reserve already.
+        bool used_before = callers;
+        if (const auto* init = container->getInit()) {
+            const auto* construct = llvm::dyn_cast<clang::CXXConstructExpr>(init->IgnoreImplicit());
+            used_before = used_before || !construct || construct->getNumArgs() != 0;
+        }
+        bool reserved = false;
+        for (const auto* use : find_uses(container, func, ctx)) {
+            if (!sm.isBeforeInTranslationUnit(use->getBeginLoc(), loop->getBeginLoc())) {
+                continue;
+            }
+            used_before = true;
+            for (const auto& parent : ctx.getParents(*use)) {
+                const auto* member = parent.get<clang::MemberExpr>();
+                if (member && member->getMemberDecl()->getIdentifier() && member->getMemberDecl()->getName() == "reserve") reserved = true;
+            }
+        }
+        if (reserved) {
+            continue;
+        }
+        if (count.empty()) {
+            count = tripCount(loop, ctx);
+            if (count.empty()) {
+                return;
+            }
+        }
+        const auto name = container->getName().str();
+        std::string bound = entry.count > 1 ? std::to_string(entry.count) + " * (" + count + ")" : count;
+        if (used_before) {
+            bound = name + ".size() + " + bound;
+        }
+        CheckProfiler::noteCounter("appends");
+        auto user_diag = diag(entry.first->getExprLoc(), "%0 grows on every iteration of a loop with a known trip count, "
+                                                         "%select{reserve() it first|reserve() it in the callers that own it}1");
+        user_diag << container << callers;
+        if (callers) {
+            continue;
+        }
+        const auto indent = sm.getPresumedColumnNumber(loop->getBeginLoc()) - 1;
+        user_diag << clang::FixItHint::CreateInsertion(loop->getBeginLoc(), name + ".reserve(" + bound + ");\n" + std::string(indent, ' '));
+        CheckProfiler::noteFixIts(1);
+    }
+}
+
+} // namespace bitcoin
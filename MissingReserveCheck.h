@@ -0,0 +1,48 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MISSINGRESERVE_CHECK_H
+#define MISSINGRESERVE_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <string>
+
+namespace bitcoin {
+
+// Finds containers declared before a loop with a known trip count (a range-for
+// over something with size(), or a counted for loop) that push_back or
+// emplace_back once per iteration without a reserve(). Inserts the reserve()
+// in front of the loop, unless the container belongs to the caller.
+class MissingReserveCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  MissingReserveCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+      : clang::tidy::ClangTidyCheck(Name, Context),
+        m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)) {
+    CheckProfiler::instance().configure(Context);
+  }
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override {
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+  }
+private:
+  // The source text of the loop's trip count, or empty if it isn't known.
+  std::string tripCount(const clang::Stmt* loop, clang::ASTContext& ctx) const;
+
+  HeaderCache m_header_cache;
+};
+
+} // namespace bitcoin
+
+#endif // MISSINGRESERVE_CHECK_H
@@ -18,7 +18,7 @@ void NoADLCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
     using namespace clang::ast_matchers;
     finder->addMatcher(
       callExpr(usesADL()).bind("adlexpr")
-    , this);
+    , CheckProfiler::instance().callback(this, "adlexpr"));
 }
 
 void NoADLCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
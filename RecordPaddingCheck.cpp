@@ -0,0 +1,322 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "RecordPaddingCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Attr.h>
+#include <clang/AST/RecordLayout.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Lex/Lexer.h>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MathExtras.h>
+
+#include <iterator>
+
+namespace {
+
+static constexpr const char* g_default_instance_counts = "CCoinsCacheEntry=1000000;CTxMemPoolEntry=1000000;CBlockIndex=1000000";
+
+static std::string format_bytes(uint64_t bytes)
+{
+    if (bytes < 10 * 1024) return std::to_string(bytes) + " bytes";
+    if (bytes < 10 * 1024 * 1024) return std::to_string(bytes / 1024) + " KiB";
+    return std::to_string(bytes / (1024 * 1024)) + " MiB";
+}
+
+// The source line containing offset, without its line break.
+static llvm::StringRef line_at(llvm::StringRef buffer, size_t offset, size_t* line_start = nullptr)
+{
+    const auto newline = buffer.rfind('\n', offset);
+    const auto begin = newline == llvm::StringRef::npos ? 0 : newline + 1;
+    if (line_start) *line_start = begin;
+    return buffer.substr(begin).take_until([](char c) { return c == '\n'; });
+}
+
+static bool is_comment_or_blank(llvm::StringRef line)
+{
+    line = line.trim();
+    return line.empty() || line.startswith("//");
+}
+
+} // namespace
+
+namespace bitcoin {
+
+RecordPaddingCheck::RecordPaddingCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_instance_counts(parse_list(Options.get("InstanceCounts", g_default_instance_counts))),
+      m_hot_fields(parse_list(Options.get("HotFields", ""))),
+      m_default_instance_count(Options.get("DefaultInstanceCount", uint64_t{0})),
+      m_cache_line_size(Options.get("CacheLineSize", 64U)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+    for (const auto& entry : m_instance_counts) {
+        const auto [name, count] = llvm::StringRef(entry).split('=');
+        uint64_t value{0};
+        if (!count.trim().getAsInteger(10, value)) {
+            m_counts[name.trim()] = value;
+        }
+    }
+}
+
+void RecordPaddingCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "InstanceCounts", join_list(m_instance_counts));
+    Options.store(Opts, "HotFields", join_list(m_hot_fields));
+    Options.store(Opts, "DefaultInstanceCount", m_default_instance_count);
+    Options.store(Opts, "CacheLineSize", m_cache_line_size);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void RecordPaddingCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    finder->addMatcher(
+      cxxRecordDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isUnion()),
+        unless(isLambda()),
+        unless(classTemplateSpecializationDecl())
+      ).bind("record"),
+    CheckProfiler::instance().callback(this, "record"));
+}
+
+uint64_t RecordPaddingCheck::instanceCount(const clang::CXXRecordDecl* record) const
+{
+    if (const auto it = m_counts.find(record->getQualifiedNameAsString()); it != m_counts.end()) {
+        return it->second;
+    }
+    if (record->getIdentifier()) {
+        if (const auto it = m_counts.find(record->getName()); it != m_counts.end()) {
+            return it->second;
+        }
+    }
+    return m_default_instance_count;
+}
+
+bool RecordPaddingCheck::isHot(const clang::CXXRecordDecl* record, const clang::FieldDecl* field) const
+{
+    const auto qualified = record->getQualifiedNameAsString() + "::" + field->getName().str();
+    const auto plain = record->getName().str() + "::" + field->getName().str();
+    return llvm::any_of(m_hot_fields, [&](const std::string& hot) { return hot == qualified || hot == plain; });
+}
+
+bool RecordPaddingCheck::canReorder(const clang::CXXRecordDecl* record, llvm::ArrayRef<const clang::FieldDecl*> fields,
+                                    llvm::ArrayRef<const clang::FieldDecl*> order, clang::ASTContext& ctx) const
+{
+    using namespace clang::ast_matchers;
+    // Aggregate initialization and structured bindings are positional,
+    // explicit layouts must stay as they are.
+    if (record->isAggregate() || record->hasAttr<clang::PackedAttr>() || record->hasAttr<clang::MaxFieldAlignmentAttr>()) {
+        return false;
+    }
+    const auto uses_this = [&](const clang::Expr* expr) {
+        return expr && !match(findAll(cxxThisExpr()), *expr, ctx).empty();
+    };
+    const auto has_side_effects = [&](const clang::Expr* expr) {
+        return expr && expr->HasSideEffects(ctx);
+    };
+    // Fields are initialized in declaration order, so no initializer may read
+    // another field. Constructors defined in other TUs can't be checked.
+    // Fields are also constructed in that order and destroyed in reverse, so
+    // those whose initialization or destruction does something must keep
+    // their relative order.
+    llvm::SmallPtrSet<const clang::FieldDecl*, 8> observable;
+    for (const auto* field : record->fields()) {
+        if (uses_this(field->getInClassInitializer())) return false;
+        if (field->getType().isDestructedType() || has_side_effects(field->getInClassInitializer())) observable.insert(field);
+    }
+    for (const auto* ctor : record->ctors()) {
+        if (ctor->isImplicit() || ctor->isDeleted()) continue;
+        const clang::FunctionDecl* definition{nullptr};
+        if (!ctor->isDefined(definition)) return false;
+        for (const auto* init : llvm::cast<clang::CXXConstructorDecl>(definition)->inits()) {
+            if (!init->isMemberInitializer()) continue;
+            if (init->isWritten() && uses_this(init->getInit())) return false;
+            if (has_side_effects(init->getInit())) observable.insert(init->getMember());
+        }
+    }
+    const auto observed = [&](llvm::ArrayRef<const clang::FieldDecl*> sequence) {
+        llvm::SmallVector<const clang::FieldDecl*, 8> ret;
+        llvm::copy_if(sequence, std::back_inserter(ret), [&](const auto* field) { return observable.count(field); });
+        return ret;
+    };
+    return observed(fields) == observed(order);
+}
+
+void RecordPaddingCheck::reorder(llvm::ArrayRef<const clang::FieldDecl*> fields, llvm::ArrayRef<const clang::FieldDecl*> order, clang::DiagnosticBuilder& user_diag, clang::ASTContext& ctx) const
+{
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+
+    // Cut the field declarations into whole lines: each field with the
+    // comments above it, the first one also with its doc comment.
+    const auto fid = sm.getFileID(fields.front()->getBeginLoc());
+    const auto buffer = sm.getBufferData(fid);
+    llvm::SmallVector<std::pair<size_t, size_t>, 16> chunks;
+    size_t end{0};
+    for (const auto* field : fields) {
+        const auto begin_loc = field->getBeginLoc();
+        const auto semi = clang::Lexer::findLocationAfterToken(field->getEndLoc(), clang::tok::semi, sm, lo, false);
+        if (begin_loc.isMacroID() || semi.isInvalid() || sm.getFileID(begin_loc) != fid || sm.getFileID(semi) != fid) {
+            return;
+        }
+        size_t begin_line{0};
+        const auto begin = sm.getFileOffset(begin_loc);
+        if (!line_at(buffer, begin, &begin_line).substr(0, begin - begin_line).trim().empty()) {
+            return;
+        }
+        size_t start{0};
+        if (chunks.empty()) {
+            start = begin_line;
+            while (start > 0) {
+                size_t previous{0};
+                if (!line_at(buffer, start - 1, &previous).trim().startswith("//")) break;
+                start = previous;
+            }
+        } else {
+            // Only comments and blank lines may sit between two fields.
+            start = end;
+            for (size_t line = start; line < begin_line;) {
+                const auto text = line_at(buffer, line);
+                if (!is_comment_or_blank(text)) return;
+                line += text.size() + 1;
+            }
+        }
+        // Nothing but a comment may follow the declaration on its line.
+        const auto after = sm.getFileOffset(semi);
+        size_t semi_line{0};
+        const auto rest = line_at(buffer, after, &semi_line).substr(after - semi_line);
+        if (!is_comment_or_blank(rest)) {
+            return;
+        }
+        end = semi_line + line_at(buffer, after).size() + 1;
+        if (end > buffer.size()) {
+            return;
+        }
+        chunks.emplace_back(start, end);
+    }
+
+    std::string text;
+    for (const auto* field : order) {
+        const auto index = std::distance(fields.begin(), llvm::find(fields, field));
+        text += buffer.slice(chunks[index].first, chunks[index].second).str();
+    }
+    const auto file_start = sm.getLocForStartOfFile(fid);
+    user_diag << clang::FixItHint::CreateReplacement(
+        clang::CharSourceRange::getCharRange(file_start.getLocWithOffset(chunks.front().first), file_start.getLocWithOffset(chunks.back().second)), text);
+    unsigned fixits{1};
+
+    // Keep member initializer lists in the new declaration order, which is
+    // the order they run in.
+    for (const auto* ctor : fields.front()->getParent()->ctors()) {
+        const clang::FunctionDecl* definition{nullptr};
+        if (ctor->isImplicit() || !ctor->isDefined(definition)) continue;
+        llvm::SmallVector<const clang::CXXCtorInitializer*, 8> written;
+        for (const auto* init : llvm::cast<clang::CXXConstructorDecl>(definition)->inits()) {
+            if (init->isWritten() && init->isMemberInitializer()) written.push_back(init);
+        }
+        if (llvm::any_of(written, [](const auto* init) { return init->getSourceRange().getBegin().isMacroID() || init->getSourceRange().getEnd().isMacroID(); })) {
+            continue;
+        }
+        auto sorted = written;
+        llvm::stable_sort(sorted, [&](const auto* a, const auto* b) {
+            return llvm::find(order, a->getMember()) < llvm::find(order, b->getMember());
+        });
+        for (size_t i = 0; i < written.size(); ++i) {
+            if (written[i] != sorted[i]) {
+                user_diag << clang::FixItHint::CreateReplacement(written[i]->getSourceRange(), get_source_text(sorted[i]->getSourceRange(), sm, lo));
+                ++fixits;
+            }
+        }
+    }
+    CheckProfiler::noteFixIts(fixits);
+}
+
+void RecordPaddingCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    const auto* record = Result.Nodes.getNodeAs<clang::CXXRecordDecl>("record");
+    auto& ctx = *Result.Context;
+    // Bit-fields and overlapping members don't follow the simple model
+    // below.
+    if (record->isDependentContext() || record->isInvalidDecl() || !has_sequential_layout(record)) {
+        return;
+    }
+    const auto count = instanceCount(record);
+    if (count == 0) {
+        return;
+    }
+    llvm::SmallVector<const clang::FieldDecl*, 16> fields(record->field_begin(), record->field_end());
+    if (fields.empty()) {
+        return;
+    }
+
+    const auto& layout = ctx.getASTRecordLayout(record);
+    const uint64_t size = layout.getSize().getQuantity();
+    const uint64_t align = layout.getAlignment().getQuantity();
+    // Fields start after the vtable pointer and bases, in either order.
+    const uint64_t start = ctx.toCharUnitsFromBits(layout.getFieldOffset(0)).getQuantity();
+    uint64_t used{0};
+    uint64_t hot_end{0};
+    for (const auto* field : fields) {
+        const auto info = field_layout(field, ctx);
+        used += info.size;
+        if (isHot(record, field)) {
+            hot_end = std::max(hot_end, ctx.toCharUnitsFromBits(layout.getFieldOffset(field->getFieldIndex())).getQuantity() + info.size);
+        }
+    }
+
+    // Hot fields first, then by decreasing alignment, which leaves no gaps
+    // between fields whose size is a multiple of their alignment.
+    auto order = fields;
+    llvm::stable_sort(order, [&](const clang::FieldDecl* a, const clang::FieldDecl* b) {
+        const bool hot_a = isHot(record, a), hot_b = isHot(record, b);
+        if (hot_a != hot_b) return hot_a;
+        return field_layout(a, ctx).align > field_layout(b, ctx).align;
+    });
+    uint64_t offset{start};
+    uint64_t new_hot_end{0};
+    for (const auto* field : order) {
+        const auto info = field_layout(field, ctx);
+        offset = llvm::alignTo(offset, info.align) + info.size;
+        if (isHot(record, field)) new_hot_end = offset;
+    }
+    const uint64_t new_size = llvm::alignTo(offset, align);
+
+    const bool shrinks = new_size < size;
+    const bool fixes_hot = hot_end > m_cache_line_size && new_hot_end <= m_cache_line_size;
+    if (!shrinks && !fixes_hot) {
+        if (hot_end > m_cache_line_size) {
+            diag(record->getLocation(), "hot fields of %0 end at byte %1, past the first %2 byte cache line, and can't all fit in it")
+                << record << static_cast<unsigned>(hot_end) << m_cache_line_size;
+        }
+        return;
+    }
+
+    const uint64_t padding = size > start + used ? size - start - used : 0;
+    CheckProfiler::noteCounter("padding", static_cast<unsigned>(padding));
+    auto user_diag = shrinks
+        ? diag(record->getLocation(), "%0 has %1 bytes of padding; reordering its fields shrinks it from %2 to %3 bytes, %4 across %5 instances")
+        : diag(record->getLocation(), "%0 has hot fields past the first %2 byte cache line; reordering its fields moves them there (%3 bytes, was %4)");
+    if (shrinks) {
+        user_diag << record << static_cast<unsigned>(padding) << static_cast<unsigned>(size) << static_cast<unsigned>(new_size)
+                  << format_bytes((size - new_size) * count) << std::to_string(count);
+    } else {
+        user_diag << record << static_cast<unsigned>(padding) << m_cache_line_size << static_cast<unsigned>(new_size) << static_cast<unsigned>(size);
+    }
+    if (canReorder(record, fields, order, ctx)) {
+        reorder(fields, order, user_diag, ctx);
+    }
+}
+
+} // namespace bitcoin
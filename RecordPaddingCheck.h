@@ -0,0 +1,56 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef RECORDPADDING_CHECK_H
+#define RECORDPADDING_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/StringMap.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Reports records whose fields could be reordered to save padding, weighted
+// by how many instances of them a node keeps around (InstanceCounts). Fields
+// listed in HotFields are kept in the first cache line. Where reordering is
+// known to be safe, the fix-it moves the field declarations, with their
+// comments, into the new order.
+class RecordPaddingCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  RecordPaddingCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  uint64_t instanceCount(const clang::CXXRecordDecl* record) const;
+  bool isHot(const clang::CXXRecordDecl* record, const clang::FieldDecl* field) const;
+  bool canReorder(const clang::CXXRecordDecl* record, llvm::ArrayRef<const clang::FieldDecl*> fields,
+                  llvm::ArrayRef<const clang::FieldDecl*> order, clang::ASTContext& ctx) const;
+  void reorder(llvm::ArrayRef<const clang::FieldDecl*> fields, llvm::ArrayRef<const clang::FieldDecl*> order, clang::DiagnosticBuilder& user_diag, clang::ASTContext& ctx) const;
+
+  const std::vector<std::string> m_instance_counts;
+  const std::vector<std::string> m_hot_fields;
+  const uint64_t m_default_instance_count;
+  const unsigned m_cache_line_size;
+  HeaderCache m_header_cache;
+
+  llvm::StringMap<uint64_t> m_counts;
+};
+
+} // namespace bitcoin
+
+#endif // RECORDPADDING_CHECK_H
@@ -0,0 +1,278 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "RepeatedHashCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <cctype>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace {
+
+static constexpr const char* g_default_getters = "GetHash;GetWitnessHash";
+
+// The local variable or parameter an object expression like a, a.b, a->b or
+// *a is rooted at, or nullptr if it involves anything else (calls,
+// subscripts, ...). Sets through_pointer if it dereferences a pointer.
+static const clang::VarDecl* root_variable(const clang::Expr* expr, bool* through_pointer = nullptr)
+{
+    while (true) {
+        expr = expr->IgnoreParenImpCasts();
+        if (const auto* ref = llvm::dyn_cast<clang::DeclRefExpr>(expr)) {
+            const auto* var = llvm::dyn_cast<clang::VarDecl>(ref->getDecl());
+            return var && var->hasLocalStorage() ? var : nullptr;
+        }
+        if (const auto* member = llvm::dyn_cast<clang::MemberExpr>(expr)) {
+            if (!llvm::isa<clang::FieldDecl>(member->getMemberDecl())) return nullptr;
+            if (member->isArrow() && through_pointer) *through_pointer = true;
+            expr = member->getBase();
+        } else if (const auto* op = llvm::dyn_cast<clang::UnaryOperator>(expr); op && op->getOpcode() == clang::UO_Deref) {
+            if (through_pointer) *through_pointer = true;
+            expr = op->getSubExpr();
+        } else if (const auto* call = llvm::dyn_cast<clang::CXXOperatorCallExpr>(expr);
+                   call && (call->getOperator() == clang::OO_Arrow || call->getOperator() == clang::OO_Star) && call->getNumArgs() == 1) {
+            // Smart pointers, e.g. CTransactionRef
+            if (through_pointer) *through_pointer = true;
+            expr = call->getArg(0);
+        } else {
+            return nullptr;
+        }
+    }
+}
+
+// Whether stmt is inside a lambda nested in func, which is checked separately.
+static bool in_lambda(const clang::Stmt* stmt, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*stmt);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty() || parents[0].get<clang::FunctionDecl>()) {
+            return false;
+        }
+        node = parents[0];
+        if (node.get<clang::LambdaExpr>()) {
+            return true;
+        }
+    }
+}
+
+// Whether stmt only runs conditionally within anchor.
+static bool is_conditional(const clang::Stmt* stmt, const clang::Stmt* anchor, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*stmt);
+    while (node.get<clang::Stmt>() != anchor) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty()) {
+            return false;
+        }
+        node = parents[0];
+        const auto* parent = node.get<clang::Stmt>();
+        if (const auto* op = parent ? llvm::dyn_cast<clang::BinaryOperator>(parent) : nullptr; op && op->isLogicalOp()) {
+            return true;
+        }
+        if (parent && llvm::isa<clang::IfStmt, clang::ConditionalOperator, clang::SwitchStmt, clang::ForStmt, clang::WhileStmt, clang::DoStmt, clang::CXXForRangeStmt>(parent)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// GetWitnessHash -> witness_hash
+static std::string local_suffix(llvm::StringRef getter)
+{
+    getter.consume_front("Get");
+    std::string ret;
+    for (const char c : getter) {
+        if (std::isupper(static_cast<unsigned char>(c))) {
+            if (!ret.empty()) ret += '_';
+            ret += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+RepeatedHashCheck::RepeatedHashCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_getters(parse_list(Options.get("PureGetters", g_default_getters))),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void RepeatedHashCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "PureGetters", join_list(m_getters));
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void RepeatedHashCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const std::vector<llvm::StringRef> getters(m_getters.begin(), m_getters.end());
+    finder->addMatcher(
+      functionDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isInstantiated()),
+        hasBody(hasDescendant(cxxMemberCallExpr(callee(cxxMethodDecl(hasAnyName(getters))))))
+      ).bind("func"),
+    CheckProfiler::instance().callback(this, "func"));
+}
+
+void RepeatedHashCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    using namespace clang::ast_matchers;
+    const auto* func = Result.Nodes.getNodeAs<clang::FunctionDecl>("func");
+    auto& ctx = *Result.Context;
+    const auto& sm = *Result.SourceManager;
+    const auto& lo = ctx.getLangOpts();
+    const std::vector<llvm::StringRef> getters(m_getters.begin(), m_getters.end());
+
+    // Calls grouped by object variable and call, as written.
+    using Key = std::pair<const clang::VarDecl*, std::string>;
+    llvm::MapVector<Key, llvm::SmallVector<const clang::CXXMemberCallExpr*, 4>, std::map<Key, unsigned>> groups;
+    for (const auto& node : match(findAll(cxxMemberCallExpr(callee(cxxMethodDecl(hasAnyName(getters)))).bind("call")), *func->getBody(), ctx)) {
+        const auto* call = node.getNodeAs<clang::CXXMemberCallExpr>("call");
+        const auto* root = root_variable(call->getImplicitObjectArgument());
+        if (call->getNumArgs() != 0 || !root || in_lambda(call, ctx)) {
+            continue;
+        }
+        groups[{root, get_source_text(call->getSourceRange(), sm, lo).str()}].push_back(call);
+    }
+
+    for (auto& [key, calls] : groups) {
+        const auto* root = key.first;
+        if (is_mutated(root, func, ctx)) {
+            continue;
+        }
+        // Loops that the object outlives repeat the calls inside them, so the
+        // result has to be computed in front of the outermost one.
+        llvm::SmallVector<const clang::Stmt*, 4> hoist_over(calls.begin(), calls.end());
+        bool in_loop{false};
+        for (const auto* call : calls) {
+            const clang::Stmt* outermost{nullptr};
+            for (const auto* loop = enclosing_loop(call, ctx); loop; loop = enclosing_loop(loop, ctx)) {
+                if (sm.isBeforeInTranslationUnit(root->getLocation(), loop->getBeginLoc())) {
+                    outermost = loop;
+                }
+            }
+            if (outermost) {
+                hoist_over.push_back(outermost);
+                in_loop = true;
+            }
+        }
+        if (calls.size() < 2 && !in_loop) {
+            continue;
+        }
+        // is_mutated() only sees root itself. A pointee that isn't const may
+        // be modified through the pointer or another alias in between, so
+        // the calls are only reported as a hint then.
+        const bool may_change = llvm::any_of(calls, [](const clang::CXXMemberCallExpr* call) {
+            bool through_pointer{false};
+            root_variable(call->getImplicitObjectArgument(), &through_pointer);
+            return through_pointer && !call->getObjectType().isConstQualified();
+        });
+        llvm::sort(calls, [&](const auto* a, const auto* b) { return sm.isBeforeInTranslationUnit(a->getBeginLoc(), b->getBeginLoc()); });
+        llvm::sort(hoist_over, [&](const auto* a, const auto* b) { return sm.isBeforeInTranslationUnit(a->getBeginLoc(), b->getBeginLoc()); });
+        CheckProfiler::noteCounter(in_loop ? "in-loop" : "repeated");
+        if (may_change) {
+            CheckProfiler::noteCounter("non-const-pointee");
+        }
+        if (in_loop) {
+            auto user_diag = diag(calls[0]->getExprLoc(), "%0 is recomputed on every loop iteration %select{for the same object, compute it once before the loop|"
+                                                          "through a pointer to non-const, compute it once before the loop if the object doesn't change}1");
+            user_diag << calls[0]->getMethodDecl() << may_change;
+            if (!may_change) {
+                hoist(func, root, calls, hoist_over, user_diag, ctx);
+            }
+        } else {
+            auto user_diag = diag(calls[0]->getExprLoc(), "%0 is computed %1 times %select{on the same object, compute it once|"
+                                                          "through a pointer to non-const, compute it once if the object doesn't change}2");
+            user_diag << calls[0]->getMethodDecl() << static_cast<unsigned>(calls.size()) << may_change;
+            if (!may_change) {
+                hoist(func, root, calls, hoist_over, user_diag, ctx);
+            }
+        }
+    }
+}
+
+void RepeatedHashCheck::hoist(const clang::FunctionDecl* func, const clang::VarDecl* root, llvm::ArrayRef<const clang::CXXMemberCallExpr*> calls,
+                              llvm::ArrayRef<const clang::Stmt*> hoist_over, clang::DiagnosticBuilder& user_diag, clang::ASTContext& ctx)
+{
+    using namespace clang::ast_matchers;
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+    for (const auto* call : calls) {
+        if (call->getBeginLoc().isMacroID() || call->getEndLoc().isMacroID()) {
+            return;
+        }
+    }
+    const auto contains = [&](const clang::Stmt* outer, const clang::Stmt* inner) {
+        return !sm.isBeforeInTranslationUnit(inner->getBeginLoc(), outer->getBeginLoc()) &&
+               !sm.isBeforeInTranslationUnit(outer->getEndLoc(), inner->getEndLoc());
+    };
+
+    // The innermost block containing every call and loop, and its statement
+    // that contains the first of them.
+    const clang::Stmt* anchor{nullptr};
+    auto node = clang::DynTypedNode::create(*hoist_over[0]);
+    while (!anchor) {
+        const auto parents = ctx.getParents(node);
+        if (parents.empty() || parents[0].get<clang::FunctionDecl>()) {
+            return;
+        }
+        const auto* child = node.get<clang::Stmt>();
+        const auto* block = parents[0].get<clang::CompoundStmt>();
+        if (child && block && llvm::all_of(hoist_over, [&](const auto* stmt) { return contains(block, stmt); })) {
+            anchor = child;
+        }
+        node = parents[0];
+    }
+    if (llvm::isa<clang::SwitchCase, clang::LabelStmt>(anchor) || anchor->getBeginLoc().isMacroID() ||
+        !sm.isBeforeInTranslationUnit(root->getLocation(), anchor->getBeginLoc())) {
+        return;
+    }
+    // Computing it up front must not dereference a pointer that the original
+    // code only dereferences behind a check (if (pindex && ...)).
+    bool through_pointer{false};
+    root_variable(calls[0]->getImplicitObjectArgument(), &through_pointer);
+    if (through_pointer && (calls[0] != hoist_over[0] || is_conditional(calls[0], anchor, ctx))) {
+        return;
+    }
+
+    const auto name = root->getName().str() + "_" + local_suffix(calls[0]->getMethodDecl()->getName());
+    if (!match(findAll(namedDecl(hasName(name))), *func->getBody(), ctx).empty() ||
+        !match(findAll(declRefExpr(to(namedDecl(hasName(name))))), *func->getBody(), ctx).empty()) {
+        return;
+    }
+    clang::PrintingPolicy policy(lo);
+    const auto type = calls[0]->getCallReturnType(ctx).getNonReferenceType().getUnqualifiedType().getAsString(policy);
+    const auto indent = sm.getPresumedColumnNumber(anchor->getBeginLoc()) - 1;
+    user_diag << clang::FixItHint::CreateInsertion(anchor->getBeginLoc(),
+        "const " + type + " " + name + " = " + get_source_text(calls[0]->getSourceRange(), sm, lo).str() + ";\n" + std::string(indent, ' '));
+    for (const auto* call : calls) {
+        user_diag << clang::FixItHint::CreateReplacement(call->getSourceRange(), name);
+    }
+    CheckProfiler::noteFixIts(calls.size() + 1);
+}
+
+} // namespace bitcoin
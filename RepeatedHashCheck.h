@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef REPEATEDHASH_CHECK_H
+#define REPEATEDHASH_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/ArrayRef.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Finds expensive pure getters such as GetHash() called more than once on the
+// same unmodified object within a function, or inside a loop that the object
+// outlives. The result is hoisted into a const local in front of the
+// statement containing the first call, and all calls are replaced with it.
+class RepeatedHashCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  RepeatedHashCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override { m_header_cache.endTranslationUnit(); }
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  void hoist(const clang::FunctionDecl* func, const clang::VarDecl* root, llvm::ArrayRef<const clang::CXXMemberCallExpr*> calls,
+             llvm::ArrayRef<const clang::Stmt*> hoist_over, clang::DiagnosticBuilder& user_diag, clang::ASTContext& ctx);
+
+  const std::vector<std::string> m_getters;
+  HeaderCache m_header_cache;
+};
+
+} // namespace bitcoin
+
+#endif // REPEATEDHASH_CHECK_H
@@ -0,0 +1,330 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "SharedPtrCopyCheck.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+
+namespace {
+
+// Whether var may be reached through something other than its name later on:
+// its address is taken, a reference is bound to it or a lambda captures it by
+// reference.
+static bool is_aliased(const clang::VarDecl* var, llvm::ArrayRef<const clang::DeclRefExpr*> uses, clang::ASTContext& ctx)
+{
+    for (const auto* use : uses) {
+        for (const auto& parent : ctx.getParents(*use)) {
+            if (const auto* op = parent.get<clang::UnaryOperator>()) {
+                if (op->getOpcode() == clang::UO_AddrOf) return true;
+            }
+            if (const auto* ref = parent.get<clang::VarDecl>()) {
+                if (ref->getType()->isReferenceType()) return true;
+            }
+            if (const auto* lambda = parent.get<clang::LambdaExpr>()) {
+                for (const auto& capture : lambda->captures()) {
+                    if (capture.capturesVariable() && capture.getCapturedVar() == var && capture.getCaptureKind() == clang::LCK_ByRef) return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Whether use may hand the pointer to something that keeps it: anything but
+// dereferencing, comparing or calling a member function on it.
+static bool may_escape(const clang::DeclRefExpr* use, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*use);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1) {
+            return true;
+        }
+        node = parents[0];
+        if (node.get<clang::ImplicitCastExpr>() || node.get<clang::ParenExpr>()) {
+            continue;
+        }
+        if (node.get<clang::MemberExpr>()) {
+            return false;
+        }
+        if (const auto* op = node.get<clang::CXXOperatorCallExpr>()) {
+            switch (op->getOperator()) {
+            case clang::OO_Arrow:
+            case clang::OO_Star:
+            case clang::OO_EqualEqual:
+            case clang::OO_ExclaimEqual:
+                return false;
+            default:
+                return true;
+            }
+        }
+        return node.get<clang::Expr>() || node.get<clang::VarDecl>() || node.get<clang::ReturnStmt>();
+    }
+}
+
+// The copy construction that use is the argument of, if any.
+static const clang::CXXConstructExpr* copy_of(const clang::DeclRefExpr* use, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*use);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1) {
+            return nullptr;
+        }
+        node = parents[0];
+        if (node.get<clang::ImplicitCastExpr>() || node.get<clang::ParenExpr>()) {
+            continue;
+        }
+        const auto* construct = node.get<clang::CXXConstructExpr>();
+        return construct && construct->getConstructor()->isCopyConstructor() ? construct : nullptr;
+    }
+}
+
+} // namespace
+
+namespace bitcoin {
+
+SharedPtrCopyCheck::SharedPtrCopyCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_pointer_types(Options.get("SharedPointerTypes", "std::shared_ptr")),
+      m_function_threshold(Options.get("FunctionThreshold", 3U)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void SharedPtrCopyCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "SharedPointerTypes", m_pointer_types.str());
+    Options.store(Opts, "FunctionThreshold", m_function_threshold);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void SharedPtrCopyCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const std::vector<llvm::StringRef> names(m_pointer_types.names().begin(), m_pointer_types.names().end());
+    const auto pointer_class = cxxRecordDecl(hasAnyName(names));
+    // Only locals can be moved from or referred to instead.
+    const auto local_source = ignoringParenImpCasts(
+        declRefExpr(to(varDecl(hasLocalStorage(), unless(hasType(referenceType())),
+                               hasType(hasUnqualifiedDesugaredType(recordType(hasDeclaration(pointer_class))))).bind("source"))).bind("use"));
+
+    finder->addMatcher(
+      cxxConstructExpr(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        hasDeclaration(cxxConstructorDecl(isCopyConstructor(), ofClass(pointer_class))),
+        hasArgument(0, local_source)
+      ).bind("copy"),
+    CheckProfiler::instance().callback(this, "copy"));
+    // Copies made inside the callee, e.g. vector::push_back(const T&), and
+    // copy assignments.
+    finder->addMatcher(
+      callExpr(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        forEachArgumentWithParam(local_source, parmVarDecl(hasType(lValueReferenceType())).bind("refparam"))
+      ).bind("refcall"),
+    CheckProfiler::instance().callback(this, "refcall"));
+    finder->addMatcher(
+      functionDecl(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        isDefinition(),
+        unless(isImplicit()),
+        unless(isInstantiated()),
+        hasAnyParameter(parmVarDecl(hasType(hasUnqualifiedDesugaredType(recordType(hasDeclaration(pointer_class))))))
+      ).bind("func"),
+    CheckProfiler::instance().callback(this, "param"));
+}
+
+void SharedPtrCopyCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    const auto* use = Result.Nodes.getNodeAs<clang::DeclRefExpr>("use");
+    const auto* source = Result.Nodes.getNodeAs<clang::VarDecl>("source");
+    if (const auto* copy = Result.Nodes.getNodeAs<clang::Expr>("copy")) {
+        checkCopy(copy, use, source, *Result.Context);
+    }
+    if (const auto* call = Result.Nodes.getNodeAs<clang::CallExpr>("refcall")) {
+        const auto* param = Result.Nodes.getNodeAs<clang::ParmVarDecl>("refparam");
+        const auto* callee = call->getDirectCallee();
+        if (callee && !is_std_move_arg(use, *Result.Context) && param->getFunctionScopeIndex() < callee->getNumParams() &&
+            has_rvalue_alternative(callee, param->getFunctionScopeIndex())) {
+            checkLastUse(call, use, source, nullptr, *Result.Context);
+        }
+    }
+    if (const auto* func = Result.Nodes.getNodeAs<clang::FunctionDecl>("func")) {
+        for (const auto* param : func->parameters()) {
+            checkParam(func, param, *Result.Context);
+        }
+    }
+}
+
+void SharedPtrCopyCheck::onEndOfTranslationUnit()
+{
+    for (const auto& [func, count] : m_copies) {
+        if (count >= m_function_threshold) {
+            diag(func->getLocation(), "%0 makes %1 avoidable shared_ptr copies") << func << count;
+        }
+    }
+    m_copies.clear();
+    m_header_cache.endTranslationUnit();
+}
+
+bool SharedPtrCopyCheck::isNeverStored(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx) const
+{
+    if (is_mutated(var, func, ctx)) {
+        return false;
+    }
+    for (const auto* use : find_uses(var, func, ctx)) {
+        if (may_escape(use, ctx) || use->refersToEnclosingVariableOrCapture()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const clang::VarDecl* SharedPtrCopyCheck::constRefAlias(const clang::Expr* copy, const clang::VarDecl* source, const clang::FunctionDecl* func, clang::ASTContext& ctx) const
+{
+    const auto parents = ctx.getParents(*copy);
+    const auto* dest = parents.size() == 1 ? parents[0].get<clang::VarDecl>() : nullptr;
+    if (dest && dest->hasLocalStorage() && !llvm::isa<clang::ParmVarDecl>(dest) && dest->getInit() == copy &&
+        !is_mutated(source, func, ctx) && isNeverStored(dest, func, ctx)) {
+        return dest;
+    }
+    return nullptr;
+}
+
+bool SharedPtrCopyCheck::isLastUse(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, const clang::FunctionDecl* func, clang::ASTContext& ctx) const
+{
+    const auto& sm = ctx.getSourceManager();
+    if (const auto* loop = enclosing_loop(copy, ctx)) {
+        // Moving from something declared outside the loop would only work
+        // for the first iteration.
+        if (!sm.isBeforeInTranslationUnit(loop->getBeginLoc(), source->getLocation())) {
+            return false;
+        }
+    }
+    const auto uses = find_uses(source, func, ctx);
+    if (is_aliased(source, uses, ctx)) {
+        return false;
+    }
+    // Other uses must be done before the full expression starts, as the
+    // evaluation order of call arguments is unspecified.
+    const auto start = full_expression(copy, ctx)->getBeginLoc();
+    for (const auto* other : uses) {
+        if (other == use || other->refersToEnclosingVariableOrCapture()) {
+            // Uses inside a lambda body refer to the lambda's own copy.
+            continue;
+        }
+        if (!sm.isBeforeInTranslationUnit(other->getEndLoc(), start)) {
+            return false;
+        }
+        // A copy that checkCopy() turns into a const reference to source
+        // reads it wherever it is used.
+        const auto* copy_use = copy_of(other, ctx);
+        if (const auto* alias = copy_use ? constRefAlias(copy_use, source, func, ctx) : nullptr) {
+            for (const auto* alias_use : find_uses(alias, func, ctx)) {
+                if (!sm.isBeforeInTranslationUnit(alias_use->getEndLoc(), start)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SharedPtrCopyCheck::checkCopy(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, clang::ASTContext& ctx)
+{
+    if (use->refersToEnclosingVariableOrCapture()) {
+        // A lambda's own copy, which operator() can't move from.
+        return;
+    }
+    const auto* func = llvm::dyn_cast_or_null<clang::FunctionDecl>(source->getParentFunctionOrMethod());
+    if (!func || !func->hasBody()) {
+        return;
+    }
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+
+    const auto parents = ctx.getParents(*copy);
+    const auto* lambda = parents.size() == 1 ? parents[0].get<clang::LambdaExpr>() : nullptr;
+
+    if (const auto* dest = constRefAlias(copy, source, func, ctx)) {
+        auto user_diag = diag(dest->getLocation(), "%0 copies %1 but is never stored, bind it as a const reference");
+        user_diag << dest << source;
+        if (make_const_ref(dest, user_diag, sm, lo)) {
+            CheckProfiler::noteFixIts(1);
+        }
+        CheckProfiler::noteCounter("const_ref");
+        ++m_copies[func];
+        return;
+    }
+
+    checkLastUse(copy, use, source, lambda, ctx);
+}
+
+void SharedPtrCopyCheck::checkLastUse(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, const clang::LambdaExpr* lambda, clang::ASTContext& ctx)
+{
+    if (use->refersToEnclosingVariableOrCapture()) {
+        return;
+    }
+    const auto* func = llvm::dyn_cast_or_null<clang::FunctionDecl>(source->getParentFunctionOrMethod());
+    if (!func || !func->hasBody() || !isLastUse(copy, use, source, func, ctx)) {
+        return;
+    }
+    const auto& sm = ctx.getSourceManager();
+    const auto& lo = ctx.getLangOpts();
+    auto user_diag = diag(use->getLocation(), "%0 is copied on its last use, move it instead");
+    user_diag << source;
+    if (lambda) {
+        // Turn a by-copy capture into an init-capture that moves.
+        for (const auto& capture : lambda->explicit_captures()) {
+            if (capture.capturesVariable() && capture.getCapturedVar() == source && !capture.getLocation().isMacroID()) {
+                const auto name = source->getName();
+                user_diag << clang::FixItHint::CreateReplacement(
+                    clang::CharSourceRange::getTokenRange(capture.getLocation()),
+                    (name + " = std::move(" + name + ")").str());
+                CheckProfiler::noteFixIts(1);
+            }
+        }
+    } else if (add_std_move(use, user_diag, sm, lo)) {
+        CheckProfiler::noteFixIts(1);
+    }
+    CheckProfiler::noteCounter("move");
+    ++m_copies[func];
+}
+
+void SharedPtrCopyCheck::checkParam(const clang::FunctionDecl* func, const clang::ParmVarDecl* param, clang::ASTContext& ctx)
+{
+    if (!func->getBody() || !param->getIdentifier() || !m_pointer_types.contains(param->getType(), ctx)) {
+        return;
+    }
+    const auto* method = llvm::dyn_cast<clang::CXXMethodDecl>(func);
+    if (!isNeverStored(param, func, ctx)) {
+        // Copies from it are reported by the copy matchers.
+        return;
+    }
+    auto user_diag = diag(param->getLocation(), "%0 is passed by value but never stored, pass it as a const reference");
+    user_diag << param;
+    CheckProfiler::noteCounter("param");
+    ++m_copies[func];
+    if (method && method->isVirtual()) {
+        // Changing the signature would break overrides in other TUs.
+        return;
+    }
+    const auto index = param->getFunctionScopeIndex();
+    for (const auto* redecl : func->redecls()) {
+        if (index < redecl->getNumParams() && make_const_ref(redecl->getParamDecl(index), user_diag, ctx.getSourceManager(), ctx.getLangOpts())) {
+            CheckProfiler::noteFixIts(1);
+        }
+    }
+}
+
+} // namespace bitcoin
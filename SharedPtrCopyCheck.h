@@ -0,0 +1,54 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SHAREDPTRCOPY_CHECK_H
+#define SHAREDPTRCOPY_CHECK_H
+
+#include "CheckProfiler.h"
+#include "CheckUtils.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/MapVector.h>
+
+namespace bitcoin {
+
+// Flags shared_ptr copies (e.g. CTransactionRef) that only cost an atomic
+// refcount increment and decrement: by-value parameters and local copies that
+// are never stored, and copies from a local on its last use. Functions with at
+// least FunctionThreshold of them get an extra summary warning so the worst
+// offenders can be ranked.
+class SharedPtrCopyCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  SharedPtrCopyCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  void checkParam(const clang::FunctionDecl* func, const clang::ParmVarDecl* param, clang::ASTContext& ctx);
+  void checkCopy(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, clang::ASTContext& ctx);
+  void checkLastUse(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, const clang::LambdaExpr* lambda, clang::ASTContext& ctx);
+  bool isLastUse(const clang::Expr* copy, const clang::DeclRefExpr* use, const clang::VarDecl* source, const clang::FunctionDecl* func, clang::ASTContext& ctx) const;
+  // The local initialized by copy if it gets the const reference fix-it.
+  const clang::VarDecl* constRefAlias(const clang::Expr* copy, const clang::VarDecl* source, const clang::FunctionDecl* func, clang::ASTContext& ctx) const;
+  bool isNeverStored(const clang::VarDecl* var, const clang::FunctionDecl* func, clang::ASTContext& ctx) const;
+
+  const TypeList m_pointer_types;
+  const unsigned m_function_threshold;
+  HeaderCache m_header_cache;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  llvm::MapVector<const clang::FunctionDecl*, unsigned> m_copies;
+};
+
+} // namespace bitcoin
+
+#endif // SHAREDPTRCOPY_CHECK_H
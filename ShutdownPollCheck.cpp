@@ -0,0 +1,143 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ShutdownPollCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Lex/Lexer.h>
+
+#include <algorithm>
+
+namespace {
+
+static constexpr const char* g_poll_counter = "shutdown_poll";
+
+static const clang::Stmt* loop_body(const clang::Stmt* loop)
+{
+    if (const auto* s = llvm::dyn_cast<clang::ForStmt>(loop)) return s->getBody();
+    if (const auto* s = llvm::dyn_cast<clang::WhileStmt>(loop)) return s->getBody();
+    if (const auto* s = llvm::dyn_cast<clang::DoStmt>(loop)) return s->getBody();
+    if (const auto* s = llvm::dyn_cast<clang::CXXForRangeStmt>(loop)) return s->getBody();
+    return nullptr;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+ShutdownPollCheck::ShutdownPollCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_poll_functions(parse_list(Options.get("PollFunctions", "ShutdownRequested"))),
+      m_poll_interval(std::max(Options.get("PollInterval", 1024U), 1U)),
+      m_max_body_calls(Options.get("MaxBodyCalls", 4U)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true)),
+      m_trigger_gate(Name.str(), m_poll_functions, Options.getLocalOrGlobal("TriggerGate", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void ShutdownPollCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "PollFunctions", join_list(m_poll_functions));
+    Options.store(Opts, "PollInterval", m_poll_interval);
+    Options.store(Opts, "MaxBodyCalls", m_max_body_calls);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+    Options.store(Opts, "TriggerGate", m_trigger_gate.enabled());
+}
+
+void ShutdownPollCheck::onEndOfTranslationUnit()
+{
+    m_reported.clear();
+    m_counted_blocks.clear();
+    m_header_cache.endTranslationUnit();
+    m_trigger_gate.endTranslationUnit();
+}
+
+void ShutdownPollCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const std::vector<llvm::StringRef> poll_functions(m_poll_functions.begin(), m_poll_functions.end());
+    finder->addMatcher(
+      callExpr(
+        unless(isInSkippedTU(&m_trigger_gate)),
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isExpansionInSystemHeader()),
+        unless(isInTemplateInstantiation()),
+        callee(functionDecl(hasAnyName(poll_functions))),
+        hasAncestor(stmt(anyOf(forStmt(), whileStmt(), doStmt(), cxxForRangeStmt())))
+      ).bind("poll"),
+    CheckProfiler::instance().callback(this, "poll"));
+}
+
+void ShutdownPollCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    using namespace clang::ast_matchers;
+    const auto* poll = Result.Nodes.getNodeAs<clang::CallExpr>("poll");
+    auto& ctx = *Result.Context;
+    const auto& sm = *Result.SourceManager;
+    const auto& lo = ctx.getLangOpts();
+
+    // Only innermost loops: an outer loop's iterations are already amortised
+    // over the inner one.
+    const auto* loop = enclosing_loop(poll, ctx);
+    if (!loop || m_reported.count(loop)) {
+        return;
+    }
+    const auto any_loop = stmt(anyOf(forStmt(), whileStmt(), doStmt(), cxxForRangeStmt()));
+    if (!match(findAll(any_loop), *loop_body(loop), ctx).empty()) {
+        return;
+    }
+
+    // The body is cheap if it makes few other calls. A range-for's begin(),
+    // end() and iterator calls don't count.
+    const std::vector<llvm::StringRef> poll_functions(m_poll_functions.begin(), m_poll_functions.end());
+    const auto* counted = llvm::isa<clang::CXXForRangeStmt>(loop) ? loop_body(loop) : loop;
+    unsigned calls{0};
+    for (const auto& node : match(findAll(expr(anyOf(callExpr(unless(callee(functionDecl(hasAnyName(poll_functions))))), cxxConstructExpr())).bind("call")), *counted, ctx)) {
+        const auto* construct = node.getNodeAs<clang::CXXConstructExpr>("call");
+        if (!construct || !construct->getConstructor()->isTrivial()) ++calls;
+    }
+    if (calls > m_max_body_calls) {
+        return;
+    }
+    const auto polls = match(findAll(callExpr(callee(functionDecl(hasAnyName(poll_functions)))).bind("poll")), *loop, ctx);
+    m_reported.insert(loop);
+
+    const auto* outer = enclosing_loop(loop, ctx);
+    auto user_diag = diag(poll->getBeginLoc(), "%0 is polled on every iteration of a loop making %1 other calls; poll every %2 iterations%select{| or once per iteration of the enclosing loop}3")
+        << poll->getDirectCallee() << calls << m_poll_interval << (outer != nullptr);
+
+    // Count iterations in front of the outermost loop, so that the count
+    // carries over between runs of the inner one, and short-circuit all but
+    // every PollInterval-th poll, starting with the first. Only plain boolean
+    // polls outside macros can be rewritten, not ones that already go through
+    // EXIT_OR_IF.
+    const clang::Stmt* outermost = loop;
+    while (const auto* next = enclosing_loop(outermost, ctx)) {
+        outermost = next;
+    }
+    const auto parents = ctx.getParents(*outermost);
+    if (polls.size() != 1 || parents.size() != 1 || !parents[0].get<clang::CompoundStmt>()) {
+        return;
+    }
+    if (!poll->getCallReturnType(ctx)->isBooleanType() || poll->getBeginLoc().isMacroID() || poll->getEndLoc().isMacroID() || outermost->getBeginLoc().isMacroID()) {
+        return;
+    }
+    // One counter per block: a sibling loop's fix-it may already declare it.
+    const auto* block = parents[0].get<clang::CompoundStmt>();
+    if (m_counted_blocks.count(block) || !match(findAll(namedDecl(hasName(g_poll_counter))), *block, ctx).empty()) {
+        return;
+    }
+    m_counted_blocks.insert(block);
+    const auto indent = clang::Lexer::getIndentationForLine(outermost->getBeginLoc(), sm);
+    const auto call_text = get_source_text(poll->getSourceRange(), sm, lo);
+    user_diag << clang::FixItHint::CreateInsertion(outermost->getBeginLoc(), "unsigned " + std::string{g_poll_counter} + "{0};\n" + indent.str())
+              << clang::FixItHint::CreateReplacement(poll->getSourceRange(), "(" + std::string{g_poll_counter} + "++ % " + std::to_string(m_poll_interval) + " == 0 && " + call_text.str() + ")");
+    CheckProfiler::noteFixIts(2);
+}
+
+} // namespace bitcoin
@@ -0,0 +1,53 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SHUTDOWNPOLL_CHECK_H
+#define SHUTDOWNPOLL_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+#include "TriggerGate.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/SmallPtrSet.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Flags PollFunctions (ShutdownRequested) called on every iteration of an
+// innermost loop whose body makes no more than MaxBodyCalls other calls, so
+// that the poll is a noticeable part of each iteration. The fix-it only polls
+// every PollInterval iterations, counted in front of the outermost loop.
+class ShutdownPollCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  ShutdownPollCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  const std::vector<std::string> m_poll_functions;
+  const unsigned m_poll_interval;
+  const unsigned m_max_body_calls;
+  HeaderCache m_header_cache;
+  TriggerGate m_trigger_gate;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  // Loops already reported, as each is matched once per poll in it.
+  llvm::SmallPtrSet<const clang::Stmt*, 8> m_reported;
+  // Blocks a fix-it already declares the counter in.
+  llvm::SmallPtrSet<const clang::CompoundStmt*, 8> m_counted_blocks;
+};
+
+} // namespace bitcoin
+
+#endif // SHUTDOWNPOLL_CHECK_H
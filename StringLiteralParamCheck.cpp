@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "StringLiteralParamCheck.h"
+#include "CheckUtils.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/ParentMapContext.h>
+#include <clang/ASTMatchers/ASTMatchFinder.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+
+#include <llvm/ADT/STLExtras.h>
+
+namespace {
+
+// Call sites that get a note, the rest are only counted.
+static constexpr unsigned MAX_NOTES{3};
+
+// std::string members that std::string_view has too, with the same meaning
+// and result type. Not substr() (a view instead of a string) nor the
+// iterators (a different type, which an explicitly typed use won't accept).
+static constexpr llvm::StringLiteral g_view_members[] = {
+    "size", "length", "empty", "front", "back", "at", "compare", "find", "rfind",
+    "find_first_of", "find_last_of", "find_first_not_of", "find_last_not_of", "copy", "max_size",
+};
+
+static bool is_std_string(clang::QualType type)
+{
+    const auto* record = type.getCanonicalType()->getAsCXXRecordDecl();
+    return record && record->isInStdNamespace() && record->getName() == "basic_string";
+}
+
+static bool is_std_string_view(clang::QualType type)
+{
+    const auto* record = type.getNonReferenceType().getCanonicalType()->getAsCXXRecordDecl();
+    return record && record->isInStdNamespace() && record->getName() == "basic_string_view";
+}
+
+// Whether this use of a string parameter would compile, and mean the same,
+// with a std::string_view.
+static bool is_view_use(const clang::DeclRefExpr* use, clang::ASTContext& ctx)
+{
+    auto node = clang::DynTypedNode::create(*use);
+    while (true) {
+        const auto parents = ctx.getParents(node);
+        if (parents.size() != 1) {
+            return false;
+        }
+        node = parents[0];
+        if (node.get<clang::ImplicitCastExpr>() || node.get<clang::ParenExpr>()) {
+            continue;
+        }
+        if (const auto* member = node.get<clang::MemberExpr>()) {
+            const auto* decl = member->getMemberDecl();
+            return decl->getIdentifier() && llvm::is_contained(g_view_members, decl->getName());
+        }
+        if (const auto* op = node.get<clang::CXXOperatorCallExpr>()) {
+            switch (op->getOperator()) {
+            case clang::OO_EqualEqual:
+            case clang::OO_ExclaimEqual:
+            case clang::OO_Less:
+            case clang::OO_LessEqual:
+            case clang::OO_Greater:
+            case clang::OO_GreaterEqual:
+            case clang::OO_Subscript:
+            case clang::OO_LessLess:
+                return true;
+            default:
+                return false;
+            }
+        }
+        if (const auto* construct = node.get<clang::CXXConstructExpr>()) {
+            // Converted to a std::string_view argument already.
+            return is_std_string_view(construct->getType());
+        }
+        return false;
+    }
+}
+
+} // namespace
+
+namespace bitcoin {
+
+// Where each file includes <string_view>, or could.
+class StringLiteralParamCheck::Recorder final : public clang::PPCallbacks {
+public:
+  Recorder(StringLiteralParamCheck& check, const clang::SourceManager& sm) : m_check(check), m_sm(sm) {}
+
+  void InclusionDirective(clang::SourceLocation hash_loc, const clang::Token&, llvm::StringRef file_name, bool angled,
+                          clang::CharSourceRange, const clang::FileEntry*, llvm::StringRef, llvm::StringRef,
+                          const clang::Module*, clang::SrcMgr::CharacteristicKind) override
+  {
+    if (!angled) {
+      return;
+    }
+    auto& includes = m_check.m_file_includes[m_sm.getFileID(hash_loc)];
+    includes.last_angled = hash_loc;
+    includes.has_string_view |= file_name == "string_view";
+  }
+
+private:
+  StringLiteralParamCheck& m_check;
+  const clang::SourceManager& m_sm;
+};
+
+StringLiteralParamCheck::StringLiteralParamCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context)
+    : clang::tidy::ClangTidyCheck(Name, Context),
+      m_min_call_sites(Options.get("MinCallSites", 1U)),
+      m_header_cache(*this, Options.getLocalOrGlobal("HeaderCache", true))
+{
+    CheckProfiler::instance().configure(Context);
+}
+
+void StringLiteralParamCheck::storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts)
+{
+    Options.store(Opts, "MinCallSites", m_min_call_sites);
+    Options.store(Opts, "HeaderCache", m_header_cache.enabled());
+}
+
+void StringLiteralParamCheck::registerPPCallbacks(const clang::SourceManager &SM, clang::Preprocessor *PP, clang::Preprocessor *ModuleExpanderPP)
+{
+    m_sm = &SM;
+    PP->addPPCallbacks(std::make_unique<Recorder>(*this, SM));
+}
+
+void StringLiteralParamCheck::registerMatchers(clang::ast_matchers::MatchFinder *finder)
+{
+    using namespace clang::ast_matchers;
+    const auto string_class = cxxRecordDecl(hasName("::std::basic_string"));
+    // The implicit std::string(const char*) conversion of the argument.
+    const auto from_chars = ignoringImplicit(cxxConstructExpr(
+        hasDeclaration(cxxConstructorDecl(ofClass(string_class))),
+        hasArgument(0, ignoringImpCasts(expr(anyOf(stringLiteral(), predefinedExpr(), hasType(pointerType(pointee(isAnyCharacter())))))))));
+    const auto string_param = parmVarDecl(hasType(lValueReferenceType(pointee(qualType(
+        isConstQualified(), hasUnqualifiedDesugaredType(recordType(hasDeclaration(string_class)))))))).bind("param");
+
+    finder->addMatcher(
+      callExpr(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isInTemplateInstantiation()),
+        callee(functionDecl(unless(isExpansionInSystemHeader()))),
+        forEachArgumentWithParam(expr(from_chars).bind("arg"), string_param)
+      ).bind("call"),
+    CheckProfiler::instance().callback(this, "call"));
+    finder->addMatcher(
+      cxxConstructExpr(
+        unless(isInDoneHeader(&m_header_cache)),
+        unless(isInTemplateInstantiation()),
+        hasDeclaration(cxxConstructorDecl(unless(isExpansionInSystemHeader()))),
+        forEachArgumentWithParam(expr(from_chars).bind("arg"), string_param)
+      ).bind("call"),
+    CheckProfiler::instance().callback(this, "construct"));
+}
+
+void StringLiteralParamCheck::check(const clang::ast_matchers::MatchFinder::MatchResult &Result)
+{
+    const auto* param = Result.Nodes.getNodeAs<clang::ParmVarDecl>("param");
+    const auto* arg = Result.Nodes.getNodeAs<clang::Expr>("arg");
+    const auto* func = llvm::dyn_cast_or_null<clang::FunctionDecl>(param->getDeclContext());
+    if (!func || !arg) {
+        return;
+    }
+    // Report on what was written, not on a template instantiation.
+    if (const auto* pattern = func->getTemplateInstantiationPattern()) {
+        func = pattern;
+    }
+    m_ctx = Result.Context;
+    m_sites[{func->getCanonicalDecl(), param->getFunctionScopeIndex()}].push_back(arg->getExprLoc());
+    CheckProfiler::noteCounter("call_sites");
+}
+
+void StringLiteralParamCheck::onEndOfTranslationUnit()
+{
+    for (const auto& [key, sites] : m_sites) {
+        const auto [canon, index] = key;
+        if (sites.size() < m_min_call_sites || index >= canon->getNumParams()) {
+            continue;
+        }
+        const auto* def = canon->getDefinition();
+        const auto* func = def ? def : canon;
+        const auto* param = func->getParamDecl(index);
+        if (!is_std_string(param->getType().getNonReferenceType())) {
+            // Part of a template parameter pack.
+            continue;
+        }
+        {
+            auto user_diag = diag(param->getLocation(), "%0 of %1 is bound to a string literal or const char* at %2 call site(s), each allocating a temporary std::string");
+            user_diag << param << canon << static_cast<unsigned>(sites.size());
+            const auto* method = llvm::dyn_cast<clang::CXXMethodDecl>(func);
+            const bool fixable = def && !(method && method->isVirtual()) && !needsOwnership(def, param, *m_ctx);
+            if (fixable) {
+                for (const auto* redecl : canon->redecls()) {
+                    const auto* redecl_param = redecl->getParamDecl(index);
+                    const auto* tsi = redecl_param->getTypeSourceInfo();
+                    const clang::SourceRange range{redecl_param->getBeginLoc(), tsi ? tsi->getTypeLoc().getEndLoc() : clang::SourceLocation{}};
+                    if (range.isInvalid() || range.getBegin().isMacroID() || range.getEnd().isMacroID()) {
+                        continue;
+                    }
+                    user_diag << clang::FixItHint::CreateReplacement(range, "std::string_view");
+                    CheckProfiler::noteFixIts(1);
+                    includeStringView(range.getBegin(), user_diag);
+                }
+            }
+        }
+        for (size_t i = 0; i < sites.size() && i < MAX_NOTES; ++i) {
+            diag(sites[i], "temporary std::string created here", clang::DiagnosticIDs::Note);
+        }
+    }
+    m_sites.clear();
+    m_ctx = nullptr;
+    m_file_includes.clear();
+    m_header_cache.endTranslationUnit();
+}
+
+void StringLiteralParamCheck::includeStringView(clang::SourceLocation loc, clang::DiagnosticBuilder& user_diag)
+{
+    // Goes on the line after the file's last angled include. Files without
+    // one are left alone rather than guessing where the include block is.
+    const auto file = m_sm->getFileID(loc);
+    const auto it = m_file_includes.find(file);
+    if (it == m_file_includes.end() || it->second.has_string_view) {
+        return;
+    }
+    const auto line = m_sm->getPresumedLineNumber(it->second.last_angled);
+    user_diag << clang::FixItHint::CreateInsertion(m_sm->translateLineCol(file, line + 1, 1), "#include <string_view>\n");
+    CheckProfiler::noteFixIts(1);
+    // Once per file, for the other parameters declared in it.
+    it->second.has_string_view = true;
+}
+
+bool StringLiteralParamCheck::needsOwnership(const clang::FunctionDecl* func, const clang::ParmVarDecl* param, clang::ASTContext& ctx) const
+{
+    for (const auto* use : find_uses(param, func, ctx)) {
+        if (!is_view_use(use, ctx)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace bitcoin
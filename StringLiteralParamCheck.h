@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef STRINGLITERALPARAM_CHECK_H
+#define STRINGLITERALPARAM_CHECK_H
+
+#include "CheckProfiler.h"
+#include "HeaderCache.h"
+
+#include <clang-tidy/ClangTidyCheck.h>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <utility>
+
+namespace bitcoin {
+
+// Finds const std::string& parameters that call sites bind string literals
+// or const char* to, which heap-allocates a temporary std::string per call
+// (e.g. __func__ and __FILE__ passed to LogPrintf_). Call sites are collected
+// per callee parameter, and reported once per TU at the parameter. When the
+// callee only reads the string, the parameter is changed to std::string_view
+// on every redeclaration, and #include <string_view> is added to the files
+// that don't include it.
+class StringLiteralParamCheck final : public clang::tidy::ClangTidyCheck {
+
+public:
+  StringLiteralParamCheck(clang::StringRef Name, clang::tidy::ClangTidyContext *Context);
+
+  bool isLanguageVersionSupported(const clang::LangOptions &LangOpts) const override {
+    return LangOpts.CPlusPlus17;
+  }
+  void registerMatchers(clang::ast_matchers::MatchFinder *Finder) override;
+  void registerPPCallbacks(const clang::SourceManager &SM, clang::Preprocessor *PP, clang::Preprocessor *ModuleExpanderPP) override;
+  void check(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
+  void onEndOfTranslationUnit() override;
+  void storeOptions(clang::tidy::ClangTidyOptions::OptionMap &Opts) override;
+private:
+  class Recorder;
+  friend class Recorder;
+
+  struct FileIncludes {
+    // Of the last #include <...>, after which <string_view> goes.
+    clang::SourceLocation last_angled;
+    bool has_string_view{false};
+  };
+
+  bool needsOwnership(const clang::FunctionDecl* func, const clang::ParmVarDecl* param, clang::ASTContext& ctx) const;
+  void includeStringView(clang::SourceLocation loc, clang::DiagnosticBuilder& user_diag);
+
+  const unsigned m_min_call_sites;
+  HeaderCache m_header_cache;
+
+  // Per-TU state, reset in onEndOfTranslationUnit().
+  clang::ASTContext* m_ctx{nullptr};
+  llvm::MapVector<std::pair<const clang::FunctionDecl*, unsigned>, llvm::SmallVector<clang::SourceLocation, 4>> m_sites;
+  const clang::SourceManager* m_sm{nullptr};
+  llvm::DenseMap<clang::FileID, FileIncludes> m_file_includes;
+};
+
+} // namespace bitcoin
+
+#endif // STRINGLITERALPARAM_CHECK_H
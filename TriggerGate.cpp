@@ -0,0 +1,80 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "TriggerGate.h"
+#include "CheckProfiler.h"
+
+#include <clang/AST/DeclCXX.h>
+
+#include <llvm/ADT/SmallPtrSet.h>
+
+namespace {
+
+// Whether name is declared in dc or a namespace nested in it. Each reopening
+// of a namespace is walked for nested ones, but looked up only once.
+bool declared_in(const clang::DeclContext* dc, clang::DeclarationName name, llvm::SmallPtrSetImpl<const clang::DeclContext*>& looked_up)
+{
+  const auto* primary = dc->getPrimaryContext();
+  if (looked_up.insert(primary).second && !primary->lookup(name).empty()) {
+    return true;
+  }
+  for (const auto* decl : dc->decls()) {
+    const auto* ns = llvm::dyn_cast<clang::NamespaceDecl>(decl);
+    if (ns && declared_in(ns, name, looked_up)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+namespace bitcoin {
+
+bool TriggerGate::skip(const clang::ASTContext& Ctx)
+{
+  if (!m_enabled) {
+    return false;
+  }
+  if (m_ctx != &Ctx) {
+    // A new TU started without us being told.
+    m_state = State::UNKNOWN;
+    m_ctx = &Ctx;
+  }
+  if (m_state == State::UNKNOWN) {
+    m_state = triggered(Ctx) ? State::RUN : State::SKIP;
+    CheckProfiler::instance().noteTriggerGate(m_key, m_state == State::SKIP);
+  }
+  return m_state == State::SKIP;
+}
+
+bool TriggerGate::triggered(const clang::ASTContext& Ctx) const
+{
+  // Most TUs never spell the identifiers at all, which the table answers
+  // without touching the AST.
+  for (const auto& name : m_spelled) {
+    if (name.empty() || Ctx.Idents.find(name) != Ctx.Idents.end()) {
+      return true;
+    }
+  }
+  llvm::SmallVector<const clang::IdentifierInfo*, 4> present;
+  for (const auto& name : m_identifiers) {
+    if (name.empty()) {
+      return true;
+    }
+    const auto it = Ctx.Idents.find(name);
+    if (it != Ctx.Idents.end()) {
+      present.push_back(it->getValue());
+    }
+  }
+  for (const auto* ident : present) {
+    llvm::SmallPtrSet<const clang::DeclContext*, 16> looked_up;
+    if (declared_in(Ctx.getTranslationUnitDecl(), clang::DeclarationName(ident), looked_up)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace bitcoin
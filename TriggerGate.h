@@ -0,0 +1,62 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef TRIGGER_GATE_H
+#define TRIGGER_GATE_H
+
+#include <clang/AST/ASTContext.h>
+#include <clang/ASTMatchers/ASTMatchers.h>
+
+#include <llvm/ADT/StringRef.h>
+
+#include <string>
+#include <vector>
+
+namespace bitcoin {
+
+// Lets a check skip TUs that can't contain anything it matches.
+//
+// A check names the identifiers it is triggered by (e.g. MaybeEarlyExit or
+// LogPrintf_). The first time a TU is asked about, they are looked up in its
+// identifier table, and those present must also resolve to a declaration at
+// namespace scope. If none do, every matcher guarded by isInSkippedTU() fails
+// on its first test for the rest of the TU. An empty identifier always
+// triggers, for checks that can't name theirs. Identifiers added as spelled
+// trigger by being in the table alone, for names that are only declared in
+// a class (member functions).
+class TriggerGate {
+public:
+  TriggerGate(std::string Key, std::vector<std::string> Identifiers, bool Enabled)
+      : m_key(std::move(Key)), m_identifiers(std::move(Identifiers)), m_enabled(Enabled) {}
+
+  bool enabled() const { return m_enabled; }
+  void addIdentifier(llvm::StringRef Name, bool Spelled = false) { (Spelled ? m_spelled : m_identifiers).push_back(Name.str()); }
+
+  // Whether no trigger identifier is declared in Ctx's TU.
+  bool skip(const clang::ASTContext& Ctx);
+
+  void endTranslationUnit() { m_state = State::UNKNOWN; }
+
+private:
+  enum class State { UNKNOWN, RUN, SKIP };
+
+  bool triggered(const clang::ASTContext& Ctx) const;
+
+  const std::string m_key;
+  std::vector<std::string> m_identifiers;
+  std::vector<std::string> m_spelled;
+  const bool m_enabled;
+  State m_state{State::UNKNOWN};
+  const clang::ASTContext* m_ctx{nullptr};
+};
+
+// Matches every node of a TU that the gate skips. Put it first so the rest of
+// the matcher is never tried there.
+AST_POLYMORPHIC_MATCHER_P(isInSkippedTU, AST_POLYMORPHIC_SUPPORTED_TYPES(clang::Decl, clang::Stmt), TriggerGate*, gate) {
+  return gate->skip(Finder->getASTContext());
+}
+
+} // namespace bitcoin
+
+#endif // TRIGGER_GATE_H
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Cory Fields
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+'''
+Scale benchmark for the bitcoin-tidy plugin.
+
+Generates parameterised TUs resembling Bitcoin Core (deep MaybeEarlyExit call
+chains, LogPrintf_ call sites, ADL-heavy namespaces and designated-initializer
+structs), runs each check over them and reports wall time, peak RSS and
+diagnostics/sec. Results are compared against a stored baseline.
+'''
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+CHECKS = [
+    # Cheapest check, approximates the cost of parsing alone.
+    'bitcoin-export-main',
+    'bitcoin-propagate-early-exit',
+    'bitcoin-unterminated-logprintf',
+    'bitcoin-adl-use',
+    'bitcoin-init-list',
+]
+
+LOGPRINTF_PRELUDE = '''#include <string>
+
+enum LogFlags {
+    NONE
+};
+
+enum Level {
+    None
+};
+
+template <typename... Args>
+static inline void LogPrintf_(const std::string& logging_function, const std::string& source_file, const int source_line, const LogFlags flag, const Level level, const char* fmt, const Args&... args)
+{
+}
+
+#define LogPrintLevel_(category, level, ...) LogPrintf_(__func__, __FILE__, __LINE__, category, level, __VA_ARGS__)
+#define LogPrintf(...) LogPrintLevel_(LogFlags::NONE, Level::None, __VA_ARGS__)
+'''
+
+
+def generate_tu(index, args):
+    out = ['// Generated by bench.py, do not edit.', '#include "early_exit.h"', LOGPRINTF_PRELUDE]
+    p = 'tu{}'.format(index)
+
+    # Deep call chains: only the leaf returns MaybeEarlyExit, every level above
+    # it is a conversion site with a different call-site shape.
+    for chain in range(args.chains):
+        out.append('MaybeEarlyExit<int> {}_leaf{}() {{ return {{}}; }}'.format(p, chain))
+        prev = '{}_leaf{}'.format(p, chain)
+        for depth in range(args.depth):
+            name = '{}_c{}_d{}'.format(p, chain, depth)
+            kind = depth % 5
+            out.append('int {}(int arg)'.format(name))
+            out.append('{')
+            call = '{}({})'.format(prev, '' if depth == 0 else 'arg')
+            if kind == 0:
+                out.append('    auto val = {};'.format(call))
+                out.append('    return arg;')
+            elif kind == 1:
+                out.append('    if ({}) {{'.format(call))
+                out.append('        return 1;')
+                out.append('    }')
+                out.append('    return 0;')
+            elif kind == 2:
+                out.append('    int val{0};')
+                out.append('    val = {};'.format(call))
+                out.append('    return val;')
+            elif kind == 3:
+                out.append('    {};'.format(call))
+                out.append('    return arg;')
+            else:
+                out.append('    if (!{}) {{'.format(call))
+                out.append('        return 0;')
+                out.append('    }')
+                out.append('    return arg;')
+            out.append('}')
+            prev = name
+
+    # LogPrintf_ call sites, every fourth one unterminated.
+    for func in range(args.log_functions):
+        out.append('void {}_log{}(int val)'.format(p, func))
+        out.append('{')
+        for site in range(args.log_sites):
+            term = '' if site % 4 == 0 else '\\n'
+            out.append('    LogPrintf("{} {} %d{}", val);'.format(func, site, term))
+        out.append('}')
+
+    # ADL-heavy namespaces: unqualified calls found only through ADL.
+    for ns in range(args.namespaces):
+        out.append('namespace {}_ns{} {{'.format(p, ns))
+        out.append('struct Obj {};')
+        for func in range(args.adl_functions):
+            out.append('inline int f{}(const Obj&) {{ return {}; }}'.format(func, func))
+        out.append('}} // namespace {}_ns{}'.format(p, ns))
+        out.append('int {}_adl{}()'.format(p, ns))
+        out.append('{')
+        out.append('    {}_ns{}::Obj obj;'.format(p, ns))
+        out.append('    int sum{0};')
+        for func in range(args.adl_functions):
+            out.append('    sum += f{}(obj);'.format(func))
+        out.append('    return sum;')
+        out.append('}')
+
+    # Designated initializers leaving members uninitialized.
+    for st in range(args.structs):
+        out.append('struct {}_Opts{} {{'.format(p, st))
+        for member in range(8):
+            out.append('    int m{};'.format(member))
+        out.append('    bool flag = false;')
+        out.append('};')
+        out.append('{0}_Opts{1} {0}_make{1}() {{ return {0}_Opts{1}{{.m1 = 1, .m3 = 3}}; }}'.format(p, st))
+
+    return '\n'.join(out) + '\n'
+
+
+def generate(args):
+    os.makedirs(args.work_dir, exist_ok=True)
+    files = []
+    for index in range(args.tus):
+        path = os.path.join(args.work_dir, 'bench_tu{}.cpp'.format(index))
+        with open(path, 'w', encoding='utf8') as f:
+            f.write(generate_tu(index, args))
+        files.append(path)
+    return files
+
+
+def run_check(args, check, files):
+    cmd = [args.clang_tidy, '--load={}'.format(args.plugin), '-checks=-*,{}'.format(check), '--quiet']
+    cmd += files
+    cmd += ['--', '-std=c++20', '-I{}'.format(args.source_dir)]
+    with tempfile.TemporaryFile() as output:
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, stdout=output, stderr=subprocess.DEVNULL)
+        _, _, rusage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+        output.seek(0)
+        text = output.read().decode('utf8', errors='replace')
+    pattern = re.compile(r': warning: .*\[{}\]$'.format(re.escape(check)), re.MULTILINE)
+    diags = len(pattern.findall(text))
+    return {
+        'wall_seconds': wall,
+        # ru_maxrss is in KiB on Linux.
+        'peak_rss_mib': rusage.ru_maxrss / 1024,
+        'diagnostics': diags,
+        'diagnostics_per_second': diags / wall if wall else 0,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--clang-tidy', default='clang-tidy')
+    parser.add_argument('--plugin', required=True, help='path to libbitcoin-tidy-experiments.so')
+    parser.add_argument('--source-dir', required=True, help='directory containing early_exit.h')
+    parser.add_argument('--work-dir', required=True, help='where generated TUs and results are written')
+    parser.add_argument('--baseline', help='baseline results to compare against')
+    parser.add_argument('--update-baseline', action='store_true', help='write the results to --baseline instead of comparing')
+    parser.add_argument('--tolerance', type=float, default=0.10, help='allowed relative wall time regression (default: %(default)s)')
+    parser.add_argument('--tus', type=int, default=8)
+    parser.add_argument('--chains', type=int, default=50)
+    parser.add_argument('--depth', type=int, default=40)
+    parser.add_argument('--log-functions', type=int, default=100)
+    parser.add_argument('--log-sites', type=int, default=20)
+    parser.add_argument('--namespaces', type=int, default=100)
+    parser.add_argument('--adl-functions', type=int, default=20)
+    parser.add_argument('--structs', type=int, default=200)
+    args = parser.parse_args()
+
+    files = generate(args)
+    params = {key: getattr(args, key) for key in ('tus', 'chains', 'depth', 'log_functions', 'log_sites', 'namespaces', 'adl_functions', 'structs')}
+    results = {check: run_check(args, check, files) for check in CHECKS}
+
+    print('{:<34} {:>10} {:>10} {:>8} {:>10}'.format('check', 'wall (s)', 'RSS (MiB)', 'diags', 'diags/s'))
+    for check, res in results.items():
+        print('{:<34} {:>10.2f} {:>10.1f} {:>8} {:>10.1f}'.format(check, res['wall_seconds'], res['peak_rss_mib'], res['diagnostics'], res['diagnostics_per_second']))
+
+    report = {'params': params, 'results': results}
+    with open(os.path.join(args.work_dir, 'results.json'), 'w', encoding='utf8') as f:
+        json.dump(report, f, indent=2)
+
+    if not args.baseline:
+        return 0
+    if args.update_baseline:
+        with open(args.baseline, 'w', encoding='utf8') as f:
+            json.dump(report, f, indent=2)
+            f.write('\n')
+        print('Baseline written to {}'.format(args.baseline))
+        return 0
+    if not os.path.exists(args.baseline):
+        print('No baseline at {}, rerun with --update-baseline to create one.'.format(args.baseline))
+        return 0
+
+    with open(args.baseline, encoding='utf8') as f:
+        baseline = json.load(f)
+    if baseline['params'] != params:
+        print('Baseline was recorded with different parameters, not comparing.')
+        return 0
+    regressed = False
+    for check, res in results.items():
+        base = baseline['results'].get(check)
+        if not base:
+            continue
+        change = res['wall_seconds'] / base['wall_seconds'] - 1 if base['wall_seconds'] else 0
+        status = 'REGRESSION' if change > args.tolerance else 'ok'
+        if res['diagnostics'] != base['diagnostics']:
+            status += ' (diagnostics {} -> {})'.format(base['diagnostics'], res['diagnostics'])
+        regressed |= change > args.tolerance
+        print('{:<34} {:>+9.1%} {}'.format(check, change, status))
+    return 1 if regressed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
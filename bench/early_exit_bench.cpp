@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Call overhead of MaybeEarlyExit results compared to the plain bool returns
+// they replace. Each variant runs a three-deep chain of non-inlined calls.
+
+#include "early_exit.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define NOINLINE __attribute__((noinline))
+
+static volatile int g_sink;
+
+NOINLINE static bool leaf_bool(int i) { return (i & 7) != 7; }
+NOINLINE static bool mid_bool(int i) { if (!leaf_bool(i)) return false; return leaf_bool(i + 1); }
+NOINLINE static bool top_bool(int i) { if (!mid_bool(i)) return false; return true; }
+
+NOINLINE static MaybeEarlyExit<bool> leaf_exit(int i)
+{
+    if (i == -1) return FatalError::BLOCK_READ_FAILED;
+    return (i & 7) != 7;
+}
+NOINLINE static MaybeEarlyExit<bool> mid_exit(int i)
+{
+    EXIT_OR_IF_NOT(leaf_exit(i)) return false;
+    EXIT_OR_DECL(bool next, leaf_exit(i + 1));
+    return next;
+}
+NOINLINE static MaybeEarlyExit<> top_exit(int i)
+{
+    EXIT_OR_IF(mid_exit(i)) g_sink = i;
+    return {};
+}
+
+template <typename F>
+static double time_ns(const char* name, long iterations, F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        f(static_cast<int>(i));
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    const double per_call = elapsed.count() / iterations;
+    std::printf("%-24s %8.3f ns/call\n", name, per_call);
+    return per_call;
+}
+
+int main(int argc, char** argv)
+{
+    const long iterations = argc > 1 ? std::atol(argv[1]) : 100000000;
+    const double base = time_ns("bool", iterations, [](int i) { if (top_bool(i)) g_sink = i; });
+    const double exit = time_ns("MaybeEarlyExit", iterations, [](int i) { if (top_exit(i).ShouldEarlyExit()) std::abort(); });
+    std::printf("overhead: %+.1f%%\n", (exit / base - 1) * 100);
+}
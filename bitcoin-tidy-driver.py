@@ -0,0 +1,311 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Cory Fields
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+'''
+Run the bitcoin-tidy plugin over a whole compile database in parallel.
+
+TUs are sharded across workers, each worker exports its fix-its, and the
+replacements are then merged: identical replacements emitted by several TUs
+(e.g. the same header fix-it from recursiveChangeType) are applied once, and
+diagnostics whose replacements conflict with an already accepted one are
+dropped as a whole and reported. Finally every file is rewritten once.
+
+With --cache-dir, each TU's dependencies, output and fix-its are kept on disk.
+Combined with --changed-since, only TUs whose own source or any included
+header changed in that git revision (range) are checked again; results for the
+rest are replayed from the cache.
+
+Other clang-tidy options (e.g. -header-filter or -config) can be passed with
+--tidy-arg.
+'''
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import shlex
+import subprocess
+import sys
+import tempfile
+from collections import defaultdict
+from concurrent.futures import ThreadPoolExecutor, as_completed
+
+try:
+    import yaml
+except ImportError:
+    yaml = None
+
+
+def load_database(build_dir, filters):
+    with open(os.path.join(build_dir, 'compile_commands.json'), encoding='utf8') as f:
+        database = json.load(f)
+    entries = {}
+    for entry in database:
+        path = os.path.realpath(os.path.join(entry['directory'], entry['file']))
+        if not filters or any(flt in path for flt in filters):
+            entries[path] = entry
+    return entries
+
+
+def sort_files(files):
+    # Largest first so the long poles start early.
+    return sorted(files, key=lambda path: (-os.path.getsize(path) if os.path.exists(path) else 0, path))
+
+
+def make_shards(files, jobs, per_shard):
+    if not files:
+        return []
+    if per_shard <= 0:
+        per_shard = max(1, len(files) // (jobs * 4))
+    # Round-robin keeps the shards similarly sized.
+    count = max(1, (len(files) + per_shard - 1) // per_shard)
+    return [files[i::count] for i in range(count)]
+
+
+def compute_deps(entry):
+    '''Every file the TU includes, by rerunning its compile command with -M.'''
+    if 'arguments' in entry:
+        args = list(entry['arguments'])
+    else:
+        args = shlex.split(entry['command'])
+    cmd = [args[0]]
+    skip = False
+    for arg in args[1:]:
+        if skip:
+            skip = False
+        elif arg in ('-o', '-MF', '-MT', '-MQ'):
+            skip = True
+        elif arg == '-c' or arg.startswith('-o') or arg in ('-M', '-MM', '-MD', '-MMD', '-MP'):
+            continue
+        else:
+            cmd.append(arg)
+    cmd += ['-M']
+    proc = subprocess.run(cmd, cwd=entry['directory'], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    if proc.returncode != 0:
+        return None
+    rule = proc.stdout.decode('utf8', errors='replace').replace('\\\n', ' ')
+    _, _, prerequisites = rule.partition(': ')
+    paths = (dep.replace('\\ ', ' ') for dep in re.findall(r'(?:\\ |\S)+', prerequisites))
+    return sorted({os.path.realpath(os.path.join(entry['directory'], dep)) for dep in paths})
+
+
+def git_changed_files(rev, some_file):
+    top = subprocess.run(['git', 'rev-parse', '--show-toplevel'], cwd=os.path.dirname(some_file),
+                         stdout=subprocess.PIPE, check=True).stdout.decode('utf8').strip()
+    names = subprocess.run(['git', 'diff', '--name-only', rev], cwd=top,
+                           stdout=subprocess.PIPE, check=True).stdout.decode('utf8').splitlines()
+    return {os.path.realpath(os.path.join(top, name)) for name in names}
+
+
+class IncrementalCache:
+    '''Per-TU dependencies, output and fix-its, keyed on the TU path.'''
+
+    def __init__(self, directory, config):
+        self.directory = directory
+        # Results are only reusable with the same checks, options and plugin.
+        self.config = hashlib.sha1(json.dumps(config, sort_keys=True).encode('utf8')).hexdigest()
+        os.makedirs(directory, exist_ok=True)
+
+    def _path(self, tu):
+        return os.path.join(self.directory, hashlib.sha1(tu.encode('utf8')).hexdigest() + '.json')
+
+    def load(self, tu):
+        try:
+            with open(self._path(tu), encoding='utf8') as f:
+                entry = json.load(f)
+        except (OSError, ValueError):
+            return None
+        return entry if entry.get('config') == self.config else None
+
+    def is_stale(self, tu, changed):
+        entry = self.load(tu)
+        if entry is None or entry['deps'] is None or changed is None:
+            return True
+        return tu in changed or any(dep in changed for dep in entry['deps'])
+
+    def store(self, tu, deps, output, fixes):
+        '''Returns whether the result digest differs from the previous run.'''
+        previous = self.load(tu)
+        digest = hashlib.sha1((output + '\0' + fixes).encode('utf8')).hexdigest()
+        entry = {'file': tu, 'config': self.config, 'deps': deps, 'output': output, 'fixes': fixes, 'digest': digest}
+        with open(self._path(tu), 'w', encoding='utf8') as f:
+            json.dump(entry, f)
+        return previous is None or previous['digest'] != digest
+
+
+def run_shard(args, shard, fixes_path, database=None):
+    '''Runs clang-tidy over shard. With a database, also returns the dependencies of its single TU.'''
+    cmd = [args.clang_tidy, '--load={}'.format(args.plugin), '-p={}'.format(args.build_dir), '--quiet']
+    if args.checks:
+        cmd.append('-checks={}'.format(args.checks))
+    cmd.append('--export-fixes={}'.format(fixes_path))
+    cmd += args.tidy_args
+    cmd += shard
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    deps = compute_deps(database[shard[0]]) if database else None
+    return proc.returncode, proc.stdout.decode('utf8', errors='replace'), proc.stderr.decode('utf8', errors='replace'), deps
+
+
+def read_fixes(fixes_path):
+    if not os.path.exists(fixes_path):
+        return ''
+    with open(fixes_path, encoding='utf8') as f:
+        return f.read()
+
+
+def parse_diagnostics(fixes):
+    exported = (yaml.safe_load(fixes) if fixes else None) or {}
+    diagnostics = []
+    for diag in exported.get('Diagnostics') or []:
+        message = diag.get('DiagnosticMessage', diag)
+        replacements = tuple(sorted(
+            (os.path.normpath(r['FilePath']), int(r['Offset']), int(r['Length']), r['ReplacementText'])
+            for r in message.get('Replacements') or []))
+        if replacements:
+            diagnostics.append((diag['DiagnosticName'], message.get('Message', ''), replacements))
+    return diagnostics
+
+
+def conflicts(a, b):
+    '''Whether two different replacements in the same file can't both apply.'''
+    _, a_off, a_len, _ = a
+    _, b_off, b_len, _ = b
+    if a_len == 0 and b_len == 0:
+        return a_off == b_off
+    if a_len == 0:
+        return b_off < a_off < b_off + b_len
+    if b_len == 0:
+        return a_off < b_off < a_off + a_len
+    return a_off < b_off + b_len and b_off < a_off + a_len
+
+
+def merge(diagnostics):
+    '''
+    Accepts each distinct diagnostic whose replacements are all either already
+    accepted or free of conflicts. Returns the accepted replacements per file
+    and the rejected diagnostics.
+    '''
+    accepted = defaultdict(set)
+    rejected = []
+    seen = set()
+    for diag in sorted(diagnostics):
+        _, _, replacements = diag
+        if replacements in seen:
+            continue
+        seen.add(replacements)
+        clash = None
+        for repl in replacements:
+            if repl in accepted[repl[0]]:
+                continue
+            clash = next((other for other in accepted[repl[0]] if conflicts(repl, other)), None)
+            if clash:
+                break
+        if clash:
+            rejected.append((diag, clash))
+            continue
+        for repl in replacements:
+            accepted[repl[0]].add(repl)
+    return accepted, rejected
+
+
+def apply(accepted):
+    for path, replacements in sorted(accepted.items()):
+        with open(path, 'rb') as f:
+            data = f.read()
+        # Back to front so earlier offsets stay valid. An insertion at the
+        # start of a replaced range ends up in front of it.
+        for _, offset, length, text in sorted(replacements, key=lambda r: (r[1], r[2]), reverse=True):
+            data = data[:offset] + text.encode('utf8') + data[offset + length:]
+        with open(path, 'wb') as f:
+            f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-p', dest='build_dir', default='.', help='directory containing compile_commands.json')
+    parser.add_argument('--plugin', required=True, help='path to libbitcoin-tidy-experiments.so')
+    parser.add_argument('--clang-tidy', default='clang-tidy')
+    parser.add_argument('--checks', help='passed to clang-tidy as -checks')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count() or 1)
+    parser.add_argument('--files-per-shard', type=int, default=0, help='TUs per clang-tidy invocation (default: balance over --jobs)')
+    parser.add_argument('--fix', action='store_true', help='apply the merged fix-its')
+    parser.add_argument('--export-fixes', help='write the merged replacements as JSON')
+    parser.add_argument('--cache-dir', help='keep per-TU results here for incremental runs')
+    parser.add_argument('--changed-since', metavar='REV', help='with --cache-dir, only recheck TUs affected by `git diff REV`')
+    parser.add_argument('--tidy-arg', dest='tidy_args', action='append', default=[], help='extra argument for clang-tidy, may be repeated')
+    parser.add_argument('files', nargs='*', help='only check TUs whose path contains one of these')
+    args = parser.parse_args()
+
+    if yaml is None:
+        print('PyYAML is required to merge fix-its.', file=sys.stderr)
+        return 1
+
+    if args.changed_since and not args.cache_dir:
+        parser.error('--changed-since requires --cache-dir')
+
+    database = load_database(args.build_dir, args.files)
+    files = sort_files(database)
+    diagnostics = []
+
+    cache = None
+    if args.cache_dir:
+        plugin = os.stat(args.plugin)
+        cache = IncrementalCache(args.cache_dir, [args.checks, args.tidy_args, args.clang_tidy, plugin.st_size, plugin.st_mtime])
+        changed = git_changed_files(args.changed_since, files[0]) if args.changed_since and files else None
+        stale = [tu for tu in files if cache.is_stale(tu, changed)]
+        for tu in files:
+            if tu in stale:
+                continue
+            entry = cache.load(tu)
+            sys.stdout.write(entry['output'])
+            diagnostics += parse_diagnostics(entry['fixes'])
+        print('Reusing cached results for {} of {} TUs'.format(len(files) - len(stale), len(files)), file=sys.stderr)
+        files = stale
+        # Results are cached per TU.
+        args.files_per_shard = 1
+
+    shards = make_shards(files, args.jobs, args.files_per_shard)
+    print('Checking {} TUs in {} shards on {} workers'.format(len(files), len(shards), args.jobs), file=sys.stderr)
+
+    failed = False
+    results_changed = 0
+    with tempfile.TemporaryDirectory(prefix='bitcoin-tidy-') as tmpdir:
+        with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+            futures = {}
+            for index, shard in enumerate(shards):
+                fixes_path = os.path.join(tmpdir, 'shard{}.yaml'.format(index))
+                futures[pool.submit(run_shard, args, shard, fixes_path, database if cache else None)] = (shard, fixes_path)
+            for future in as_completed(futures):
+                shard, fixes_path = futures[future]
+                returncode, out, err, deps = future.result()
+                failed |= returncode != 0
+                sys.stdout.write(out)
+                sys.stderr.write(err)
+                fixes = read_fixes(fixes_path)
+                diagnostics += parse_diagnostics(fixes)
+                if cache and returncode == 0:
+                    tu = shard[0]
+                    results_changed += cache.store(tu, deps, out, fixes)
+    if cache:
+        print('{} of {} rechecked TUs have changed results'.format(results_changed, len(files)), file=sys.stderr)
+
+    accepted, rejected = merge(diagnostics)
+    total = sum(len(replacements) for replacements in accepted.values())
+    print('{} distinct replacements in {} files, {} conflicting diagnostics dropped'.format(total, len(accepted), len(rejected)), file=sys.stderr)
+    for (name, message, replacements), clash in rejected:
+        path, offset, _, _ = replacements[0]
+        print('conflict: {}:{}: {} [{}] overlaps replacement at offset {}'.format(path, offset, message, name, clash[1]), file=sys.stderr)
+
+    if args.export_fixes:
+        with open(args.export_fixes, 'w', encoding='utf8') as f:
+            json.dump({path: [{'offset': o, 'length': l, 'text': t} for _, o, l, t in sorted(repls)] for path, repls in accepted.items()}, f, indent=1)
+    if args.fix:
+        apply(accepted)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -4,9 +4,21 @@
 
 #include "EarlyExitTidyModule.h"
 #include "ExportMainCheck.h"
+#include "FalseSharingCheck.h"
+#include "HeterogeneousLookupCheck.h"
+#include "IncludeCostCheck.h"
 #include "InitListCheck.h"
+#include "LargeByValueCheck.h"
+#include "LockHeldWorkCheck.h"
 #include "LogPrintfCheck.h"
+#include "MissingMoveCheck.h"
+#include "MissingReserveCheck.h"
 #include "NoADLCheck.h"
+#include "RecordPaddingCheck.h"
+#include "RepeatedHashCheck.h"
+#include "SharedPtrCopyCheck.h"
+#include "ShutdownPollCheck.h"
+#include "StringLiteralParamCheck.h"
 
 #include <clang-tidy/ClangTidyModule.h>
 #include <clang-tidy/ClangTidyModuleRegistry.h>
@@ -19,6 +31,18 @@ public:
     CheckFactories.registerCheck<bitcoin::NoADLCheck>("bitcoin-adl-use");
     CheckFactories.registerCheck<bitcoin::ExportMainCheck>("bitcoin-export-main");
     CheckFactories.registerCheck<bitcoin::InitListCheck>("bitcoin-init-list");
+    CheckFactories.registerCheck<bitcoin::LargeByValueCheck>("bitcoin-large-by-value");
+    CheckFactories.registerCheck<bitcoin::SharedPtrCopyCheck>("bitcoin-shared-ptr-copy");
+    CheckFactories.registerCheck<bitcoin::StringLiteralParamCheck>("bitcoin-string-literal-param");
+    CheckFactories.registerCheck<bitcoin::MissingReserveCheck>("bitcoin-missing-reserve");
+    CheckFactories.registerCheck<bitcoin::LockHeldWorkCheck>("bitcoin-lock-held-work");
+    CheckFactories.registerCheck<bitcoin::HeterogeneousLookupCheck>("bitcoin-heterogeneous-lookup");
+    CheckFactories.registerCheck<bitcoin::RepeatedHashCheck>("bitcoin-repeated-hash");
+    CheckFactories.registerCheck<bitcoin::MissingMoveCheck>("bitcoin-missing-move");
+    CheckFactories.registerCheck<bitcoin::IncludeCostCheck>("bitcoin-include-cost");
+    CheckFactories.registerCheck<bitcoin::RecordPaddingCheck>("bitcoin-record-padding");
+    CheckFactories.registerCheck<bitcoin::FalseSharingCheck>("bitcoin-false-sharing");
+    CheckFactories.registerCheck<bitcoin::ShutdownPollCheck>("bitcoin-shutdown-poll");
   }
 };
 
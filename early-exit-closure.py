@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Cory Fields
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+'''
+Merge the per-TU call graph summaries written by bitcoin-propagate-early-exit
+(SummaryDir option) and compute every function that has to return
+MaybeEarlyExit, i.e. the transitive callers of ShutdownRequested/StartShutdown
+and of anything already returning MaybeEarlyExit.
+
+The result is fed back to the check via its EarlyExitClosure option so that a
+single rewrite pass applies all fix-its.
+'''
+
+import argparse
+import json
+import os
+import sys
+from collections import defaultdict
+
+
+def load_summaries(summary_dir):
+    functions = {}
+    callers = defaultdict(set)
+    for name in sorted(os.listdir(summary_dir)):
+        if not name.endswith('.json'):
+            continue
+        with open(os.path.join(summary_dir, name), encoding='utf8') as f:
+            summary = json.load(f)
+        for func in summary['functions']:
+            # Inline functions from headers show up once per TU, merge them.
+            entry = functions.setdefault(func['key'], {'returns_early_exit': False, 'main': False, 'root': False})
+            for attr in ('returns_early_exit', 'main', 'root'):
+                entry[attr] = entry[attr] or func[attr]
+            for callee in func['callees']:
+                callers[callee].add(func['key'])
+    return functions, callers
+
+
+def compute_closure(functions, callers):
+    closure = set()
+    worklist = [key for key, entry in functions.items() if entry['root'] or entry['returns_early_exit']]
+    while worklist:
+        key = worklist.pop()
+        if key in closure:
+            continue
+        closure.add(key)
+        worklist.extend(callers.get(key, ()))
+    # main can't be converted, and functions already returning MaybeEarlyExit
+    # don't need to be.
+    return sorted(key for key in closure if not functions.get(key, {}).get('main') and not functions.get(key, {}).get('returns_early_exit'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('summary_dir', help='directory passed as SummaryDir to bitcoin-propagate-early-exit')
+    parser.add_argument('-o', '--output', default='-', help='closure file for the EarlyExitClosure option (default: stdout)')
+    args = parser.parse_args()
+
+    functions, callers = load_summaries(args.summary_dir)
+    closure = compute_closure(functions, callers)
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w', encoding='utf8')
+    out.write('# {} functions to convert to MaybeEarlyExit\n'.format(len(closure)))
+    for key in closure:
+        out.write(key + '\n')
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
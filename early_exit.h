@@ -6,6 +6,11 @@
 #define BITCOIN_EARLY_EXIT_H
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 
 enum class FatalError
@@ -25,7 +30,7 @@ enum class FatalError
     UNDO_WRITE_FAILED
 };
 
-enum class VoidType{};
+enum class VoidType : uint8_t {};
 
 enum class UserInterrupted
 {
@@ -35,101 +40,340 @@ enum class UserInterrupted
 
 using EarlyExit = std::variant<std::monostate, FatalError, UserInterrupted>;
 
+// Early exits are rare: keep the error path out of line and out of the way of
+// the fast path, which should stay a single test-and-branch.
+#if defined(__GNUC__)
+#define EARLY_EXIT_COLD __attribute__((cold, noinline))
+#define EARLY_EXIT_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#elif defined(_MSC_VER)
+#define EARLY_EXIT_COLD __declspec(noinline)
+#define EARLY_EXIT_UNLIKELY(x) (x)
+#else
+#define EARLY_EXIT_COLD
+#define EARLY_EXIT_UNLIKELY(x) (x)
+#endif
+
+// Call site of the function whose default argument this is, like
+// std::source_location::current() before C++20.
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define EARLY_EXIT_FILE() __builtin_FILE()
+#define EARLY_EXIT_LINE() static_cast<uint32_t>(__builtin_LINE())
+#else
+#define EARLY_EXIT_FILE() nullptr
+#define EARLY_EXIT_LINE() uint32_t{0}
+#endif
+
+// Where an early exit came from: the file and line of the originating
+// return, an errno-style code and a short tag, so that the top-level caller
+// can report it without every level in between logging. Fixed size and
+// trivially copyable, so creating and propagating it never allocates.
+//
+// Only recorded when EARLY_EXIT_CONTEXT is defined, as it grows small results
+// from two bytes to the size of the context. Otherwise the interface stays,
+// but records nothing.
+class EarlyExitContext
+{
+public:
+    static constexpr size_t TAG_SIZE{8};
+
+    constexpr EarlyExitContext() = default;
+#ifndef EARLY_EXIT_CONTEXT
+    constexpr EarlyExitContext(const char*, uint32_t, int32_t = 0, const char* = nullptr) {}
+
+    constexpr const char* GetFile() const { return nullptr; }
+    constexpr uint32_t GetLine() const { return 0; }
+    constexpr int32_t GetCode() const { return 0; }
+    constexpr std::string_view GetTag() const { return {}; }
+    constexpr EarlyExitContext WithLocation(const char*, uint32_t) const { return *this; }
+#else
+    // Only the first TAG_SIZE characters of tag are kept.
+    constexpr EarlyExitContext(const char* file, uint32_t line, int32_t code = 0, const char* tag = nullptr)
+        : m_file(file), m_line(line), m_code(code)
+    {
+        for (size_t i = 0; tag && i < TAG_SIZE && tag[i]; ++i) {
+            m_tag[i] = tag[i];
+        }
+    }
+
+    // nullptr if the compiler can't tell where the early exit came from.
+    constexpr const char* GetFile() const { return m_file; }
+    constexpr uint32_t GetLine() const { return m_line; }
+    // 0 if none was given.
+    constexpr int32_t GetCode() const { return m_code; }
+    constexpr std::string_view GetTag() const
+    {
+        size_t size{0};
+        while (size < TAG_SIZE && m_tag[size]) ++size;
+        return {m_tag, size};
+    }
+
+    // This context, with file and line filled in if they are unknown.
+    constexpr EarlyExitContext WithLocation(const char* file, uint32_t line) const
+    {
+        EarlyExitContext ret{*this};
+        if (!ret.m_file) {
+            ret.m_file = file;
+            ret.m_line = line;
+        }
+        return ret;
+    }
+
+private:
+    const char* m_file{nullptr};
+    uint32_t m_line{0};
+    int32_t m_code{0};
+    char m_tag[TAG_SIZE]{};
+#endif
+};
+
+static_assert(std::is_trivially_copyable_v<EarlyExitContext>);
+
+namespace early_exit_detail {
+
+// The whole status of a MaybeEarlyExit fits in one byte: 0 when it holds a
+// value, FatalError codes + 1 below 0x80, UserInterrupted codes with the top
+// bit set.
+static constexpr uint8_t STATUS_VALUE{0};
+static constexpr uint8_t STATUS_USER_INTERRUPTED{0x80};
+static_assert(static_cast<int>(FatalError::UNDO_WRITE_FAILED) + 1 < STATUS_USER_INTERRUPTED);
+static_assert(static_cast<int>(UserInterrupted::BLOCK_IMPORT_COMPLETE) < STATUS_USER_INTERRUPTED);
+
+constexpr uint8_t Encode(FatalError err) { return static_cast<uint8_t>(static_cast<int>(err) + 1); }
+constexpr uint8_t Encode(UserInterrupted err) { return static_cast<uint8_t>(static_cast<int>(err) | STATUS_USER_INTERRUPTED); }
+
+inline uint8_t Encode(const EarlyExit& err)
+{
+    if (std::holds_alternative<UserInterrupted>(err)) {
+        return Encode(std::get<UserInterrupted>(err));
+    }
+    if (std::holds_alternative<FatalError>(err)) {
+        return Encode(std::get<FatalError>(err));
+    }
+    return Encode(FatalError::UNKNOWN);
+}
+
+inline EarlyExit Decode(uint8_t status)
+{
+    if (status == STATUS_VALUE) {
+        return std::monostate{};
+    }
+    if (status & STATUS_USER_INTERRUPTED) {
+        return static_cast<UserInterrupted>(status & ~STATUS_USER_INTERRUPTED);
+    }
+    return static_cast<FatalError>(status - 1);
+}
+
+// Value and status tag. The value is only alive while the status is
+// STATUS_VALUE, the context shares its space and is alive otherwise.
+// Trivially copyable values keep the whole thing trivially copyable, so that
+// results like MaybeEarlyExit<bool> are returned in registers rather than
+// through memory (unless EARLY_EXIT_CONTEXT is defined).
+template <typename T, bool = std::is_trivially_copyable_v<T>>
+class Storage
+{
+protected:
+    template <typename... Args>
+    explicit Storage(std::in_place_t, Args&&... args) : m_value(std::forward<Args>(args)...), m_status(STATUS_VALUE) {}
+    Storage(uint8_t status, const EarlyExitContext& context) : m_context(context), m_status(status) {}
+
+    Storage(const Storage&) = delete;
+    Storage(Storage&&) = delete;
+    ~Storage()
+    {
+        if (m_status == STATUS_VALUE) m_value.~T();
+    }
+
+    union {
+        T m_value;
+        EarlyExitContext m_context;
+    };
+    uint8_t m_status;
+};
+
+template <typename T>
+class Storage<T, true>
+{
+protected:
+    template <typename... Args>
+    explicit Storage(std::in_place_t, Args&&... args) : m_value(std::forward<Args>(args)...), m_status(STATUS_VALUE) {}
+    Storage(uint8_t status, const EarlyExitContext& context) : m_context(context), m_status(status) {}
+
+    union {
+        T m_value;
+        EarlyExitContext m_context;
+    };
+    uint8_t m_status;
+};
+
+// Status and context handed from a failed MaybeEarlyExit<T> to the caller's
+// MaybeEarlyExit<U> by the macros below and by BubbleUp().
+struct Status {
+    uint8_t value;
+    EarlyExitContext context;
+
+    operator EarlyExit() const { return Decode(value); }
+};
+
+struct Access;
+
+} // namespace early_exit_detail
+
 template <typename T>
 class MaybeEarlyExit;
 
 template <typename T>
-EarlyExit BubbleUp(MaybeEarlyExit<T>&& ret);
+early_exit_detail::Status BubbleUp(MaybeEarlyExit<T>&& ret, const char* file = EARLY_EXIT_FILE(), uint32_t line = EARLY_EXIT_LINE());
 
 template <typename T = VoidType>
-class [[nodiscard]] MaybeEarlyExit : std::variant<T, FatalError, UserInterrupted>
+class [[nodiscard]] MaybeEarlyExit : early_exit_detail::Storage<T>
 {
-    EarlyExit Bubble() const &&
+    using Base = early_exit_detail::Storage<T>;
+    using Base::m_status;
+    using Base::m_value;
+    using Base::m_context;
+
+    // The status and context to hand up, located at file and line if the
+    // origin is unknown.
+    early_exit_detail::Status Bubble(const char* file, uint32_t line) const &&
     {
-        if (std::holds_alternative<FatalError>(*this)) {
-            return std::get<FatalError>(*this);
-        } else if (std::holds_alternative<UserInterrupted>(*this)) {
-            return std::get<UserInterrupted>(*this);
-        } else {
-            return FatalError::UNKNOWN;
+        if (!ShouldEarlyExit()) {
+            return {early_exit_detail::Encode(FatalError::UNKNOWN), EarlyExitContext{file, line}};
         }
+        return {m_status, m_context.WithLocation(file, line)};
     }
-    friend EarlyExit BubbleUp<T>(MaybeEarlyExit<T>&&);
+    friend early_exit_detail::Status BubbleUp<T>(MaybeEarlyExit<T>&&, const char*, uint32_t);
+    friend struct early_exit_detail::Access;
 
 public:
-    using underlying = std::variant<T, FatalError, UserInterrupted>;
-    using std::variant<T, FatalError, UserInterrupted>::variant;
+    // Success, holding a value-initialized T.
+    MaybeEarlyExit() : Base(std::in_place) {}
+
+    template <typename U = T, typename = std::enable_if_t<
+        std::is_constructible_v<T, U&&> &&
+        !std::is_same_v<std::decay_t<U>, MaybeEarlyExit> &&
+        !std::is_same_v<std::decay_t<U>, FatalError> &&
+        !std::is_same_v<std::decay_t<U>, UserInterrupted> &&
+        !std::is_same_v<std::decay_t<U>, EarlyExit> &&
+        !std::is_same_v<std::decay_t<U>, early_exit_detail::Status>>>
+    MaybeEarlyExit(U&& val) : Base(std::in_place, std::forward<U>(val)) {}
+
+    // The location of the return (or other expression) creating the error is
+    // recorded in its context, e.g. "return FatalError::BLOCK_READ_FAILED;".
+    // An errno-style code and a short tag can be added with
+    // "return {FatalError::BLOCK_WRITE_FAILED, errno, "blk"};".
+    MaybeEarlyExit(FatalError err, int32_t code = 0, const char* tag = nullptr, const char* file = EARLY_EXIT_FILE(), uint32_t line = EARLY_EXIT_LINE())
+        : Base(early_exit_detail::Encode(err), EarlyExitContext{file, line, code, tag}) {}
+    MaybeEarlyExit(UserInterrupted err, int32_t code = 0, const char* tag = nullptr, const char* file = EARLY_EXIT_FILE(), uint32_t line = EARLY_EXIT_LINE())
+        : Base(early_exit_detail::Encode(err), EarlyExitContext{file, line, code, tag}) {}
 
-    // No copying or moving, only bubbling up.
+    // An empty EarlyExit is treated as FatalError::UNKNOWN, so this works even
+    // when T can't be default-constructed
+    MaybeEarlyExit(const EarlyExit& err, const char* file = EARLY_EXIT_FILE(), uint32_t line = EARLY_EXIT_LINE())
+        : Base(early_exit_detail::Encode(err), EarlyExitContext{file, line}) {}
+
+    MaybeEarlyExit(early_exit_detail::Status status) : Base(status.value, status.context) {}
+
+    // No assigning, only bubbling up. Copy/move construction is only
+    // available (and trivial) when T is trivially copyable.
     MaybeEarlyExit& operator=(const MaybeEarlyExit&) = delete;
-    MaybeEarlyExit(const MaybeEarlyExit&) = delete;
+    MaybeEarlyExit(const MaybeEarlyExit&) = default;
     MaybeEarlyExit& operator=(MaybeEarlyExit&&) = delete;
-    MaybeEarlyExit(MaybeEarlyExit&&) = delete;
+    MaybeEarlyExit(MaybeEarlyExit&&) = default;
 
-    // Set to FatalError by default so this works even when T can't be default-constructed
-    MaybeEarlyExit(EarlyExit err) : std::variant<T, FatalError, UserInterrupted>(FatalError::UNKNOWN)
+    bool ShouldEarlyExit() const
     {
-        if (std::holds_alternative<FatalError>(err)) {
-            underlying::template emplace<FatalError>(std::get<FatalError>(err));
-        } else if (std::holds_alternative<UserInterrupted>(err)) {
-            underlying::template emplace<UserInterrupted>(std::get<UserInterrupted>(err));
-        }
+        return m_status != early_exit_detail::STATUS_VALUE;
     }
 
-    bool ShouldEarlyExit() const
-    {
-        return !std::holds_alternative<T>(*this);
+    const T& operator*() const& {
+        assert(!ShouldEarlyExit());
+        return m_value;
     }
 
-    const T& operator*() const {
+    T& operator*() & {
         assert(!ShouldEarlyExit());
-        return std::get<T>(*this);
+        return m_value;
     }
 
-    T& operator*() {
+    // Extracting from an rvalue moves the value out instead of copying it.
+    T&& operator*() && {
         assert(!ShouldEarlyExit());
-        return std::get<T>(*this);
+        return std::move(m_value);
     }
 
     // Only intended for use by top-level callers to report errors
     EarlyExit GetEarlyExit() const
     {
-        if (std::holds_alternative<UserInterrupted>(*this)) {
-            return std::get<UserInterrupted>(*this);
-        }
-        if (std::holds_alternative<FatalError>(*this)) {
-            return std::get<FatalError>(*this);
-        }
-        return std::monostate{};
+        return early_exit_detail::Decode(m_status);
+    }
+
+    // Where the early exit came from. Empty when holding a value.
+    EarlyExitContext GetEarlyExitContext() const
+    {
+        return ShouldEarlyExit() ? m_context : EarlyExitContext{};
     }
 
     // Semantics similar to std::map::try_emplace
     // Only moves the value out if it exists, otherwise assume the caller
     // will bubble it up.
-    bool TryMoveOut(T& val) const
+    bool TryMoveOut(T& val) &&
     {
         if (ShouldEarlyExit()) {
             return false;
         }
-        val = std::move(std::get<T>(*this));
+        val = std::move(m_value);
         return true;
     }
 
     // To remove after transform
-    [[deprecated]] operator T() const
+    [[deprecated]] operator T() const&
+    {
+        assert(!ShouldEarlyExit());
+        return m_value;
+    }
+
+    [[deprecated]] operator T() &&
     {
         assert(!ShouldEarlyExit());
-        return std::get<T>(*this);
+        return std::move(m_value);
     }
 };
 
-// User function to walk up the call-stack
+#ifndef EARLY_EXIT_CONTEXT
+// Keep the common results as cheap to return as the bool they replace.
+static_assert(sizeof(MaybeEarlyExit<>) == 2);
+static_assert(sizeof(MaybeEarlyExit<bool>) == 2);
+#else
+// The context shares its space with the value, so only small values grow.
+static_assert(sizeof(MaybeEarlyExit<>) == sizeof(EarlyExitContext) + alignof(EarlyExitContext));
+static_assert(sizeof(MaybeEarlyExit<EarlyExitContext>) == sizeof(MaybeEarlyExit<>));
+#endif
+static_assert(std::is_trivially_copyable_v<MaybeEarlyExit<>>);
+static_assert(std::is_trivially_copyable_v<MaybeEarlyExit<bool>>);
+static_assert(std::is_trivially_destructible_v<MaybeEarlyExit<bool>>);
+
+// User function to walk up the call-stack. The result converts to an
+// EarlyExit, or to the caller's MaybeEarlyExit<U> with the context intact.
 template <typename T>
-EarlyExit BubbleUp(MaybeEarlyExit<T>&& ret)
+EARLY_EXIT_COLD early_exit_detail::Status BubbleUp(MaybeEarlyExit<T>&& ret, const char* file, uint32_t line)
 {
-    return std::move(ret).Bubble();
+    return std::move(ret).Bubble(file, line);
 }
 
+namespace early_exit_detail {
+
+struct Access {
+    // The out-of-line error path of the macros, which pass their own
+    // location in case the origin's is unknown.
+    template <typename T>
+    EARLY_EXIT_COLD static Status Propagate(MaybeEarlyExit<T>&& ret, const char* file, uint32_t line)
+    {
+        return std::move(ret).Bubble(file, line);
+    }
+};
+
+} // namespace early_exit_detail
+
 #ifndef PASTE
 #define PASTE(x, y) x ## y
 #endif
@@ -138,13 +382,14 @@ EarlyExit BubbleUp(MaybeEarlyExit<T>&& ret)
 #endif
 
 #define BUBBLE_UP(func) BubbleUp(func)
-#define MAYBE_EXIT(func) if(auto tmp_int_ret = func; tmp_int_ret.ShouldEarlyExit()) return BubbleUp(std::move(tmp_int_ret));
-#define EXIT_OR_ASSIGN(ret_val, func) if (auto tmp_int_ret = func; !tmp_int_ret.TryMoveOut(ret_val)) return BubbleUp(std::move(tmp_int_ret));
-#define EXIT_OR_IF(func) if(auto tmp_int_ret = func; tmp_int_ret.ShouldEarlyExit()) return BubbleUp(std::move(tmp_int_ret)); else if (*tmp_int_ret)
-#define EXIT_OR_IF_NOT(func) if(auto tmp_int_ret = func; tmp_int_ret.ShouldEarlyExit()) return BubbleUp(std::move(tmp_int_ret)); else if (!*tmp_int_ret)
+#define EARLY_EXIT_PROPAGATE(tmp) early_exit_detail::Access::Propagate(std::move(tmp), __FILE__, __LINE__)
+#define MAYBE_EXIT(func) if(auto tmp_int_ret = func; EARLY_EXIT_UNLIKELY(tmp_int_ret.ShouldEarlyExit())) return EARLY_EXIT_PROPAGATE(tmp_int_ret);
+#define EXIT_OR_ASSIGN(ret_val, func) if (auto tmp_int_ret = func; EARLY_EXIT_UNLIKELY(!std::move(tmp_int_ret).TryMoveOut(ret_val))) return EARLY_EXIT_PROPAGATE(tmp_int_ret);
+#define EXIT_OR_IF(func) if(auto tmp_int_ret = func; EARLY_EXIT_UNLIKELY(tmp_int_ret.ShouldEarlyExit())) return EARLY_EXIT_PROPAGATE(tmp_int_ret); else if (*tmp_int_ret)
+#define EXIT_OR_IF_NOT(func) if(auto tmp_int_ret = func; EARLY_EXIT_UNLIKELY(tmp_int_ret.ShouldEarlyExit())) return EARLY_EXIT_PROPAGATE(tmp_int_ret); else if (!*tmp_int_ret)
 // Because the temporary here cannot be scoped like the others, make it per-line unique
 // __COUNTER__ could potentially be used instead, but it's non-standard and confuses LTO.
-#define EXIT_OR_DECL(ret_val, func) auto PASTE2(tmp_int_ret, __LINE__) = func; if(PASTE2(tmp_int_ret, __LINE__).ShouldEarlyExit()) return BubbleUp(std::move(PASTE2(tmp_int_ret, __LINE__))); ret_val = std::move(*PASTE2(tmp_int_ret, __LINE__));
+#define EXIT_OR_DECL(ret_val, func) auto PASTE2(tmp_int_ret, __LINE__) = func; if(EARLY_EXIT_UNLIKELY(PASTE2(tmp_int_ret, __LINE__).ShouldEarlyExit())) return EARLY_EXIT_PROPAGATE(PASTE2(tmp_int_ret, __LINE__)); ret_val = *std::move(PASTE2(tmp_int_ret, __LINE__));
 
 
 // NOOP versions of the same macros for temporarily catching in top-level functions
@@ -0,0 +1,75 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about expensive types that are copied by value.
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct CTransaction {
+    std::vector<unsigned char> vin;
+    std::vector<unsigned char> vout;
+};
+
+struct CBlock {
+    std::vector<CTransaction> vtx;
+};
+
+struct CBlockHeader {
+    unsigned char data[80];
+};
+
+struct Holder {
+    CTransaction m_tx;
+    Holder(CTransaction tx) : m_tx(tx) {} // warns, std::move(tx)
+};
+
+size_t CountInputs(CTransaction tx); // also gets the fix-it
+size_t CountInputs(CTransaction tx) // warns, const CTransaction&
+{
+    return tx.vin.size();
+}
+
+void Strip(CTransaction tx) // warns, no fix-it (mutated)
+{
+    tx.vin.clear();
+}
+
+void Store(CTransaction tx, std::vector<CTransaction>& out) // doesn't warn, already a sink
+{
+    out.push_back(std::move(tx));
+}
+
+struct ConstHolder {
+    CTransaction m_tx;
+    ConstHolder(const CTransaction tx) : m_tx(tx) {} // warns, const CTransaction& (moving a const copies)
+};
+
+void StoreConst(const CTransaction tx, std::vector<CTransaction>& out) // warns, const CTransaction&
+{
+    out.push_back(std::move(tx));
+}
+
+bool CheckHeader(CBlockHeader header) // warns, larger than SizeThreshold
+{
+    return header.data[0] == 0;
+}
+
+void Relay(std::shared_ptr<const CTransaction> tx) {} // doesn't warn, see AllowedTypes
+
+size_t CountBlockInputs(const CBlock& block)
+{
+    size_t ret{0};
+    for (CTransaction tx : block.vtx) { // warns, const CTransaction&
+        ret += tx.vin.size();
+    }
+    for (auto tx : block.vtx) { // doesn't warn, modifies its copy
+        tx.vin.clear();
+    }
+    for (const auto& tx : block.vtx) { // doesn't warn
+        ret += tx.vout.size();
+    }
+    return ret;
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about members written under different locks sharing a cache line.
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#if defined(__clang__)
+#define GUARDED_BY(x) __attribute__((guarded_by(x)))
+#else
+#define GUARDED_BY(x)
+#endif
+
+template <typename PARENT>
+class AnnotatedMixin : public PARENT {};
+using Mutex = AnnotatedMixin<std::mutex>;
+
+class CConnman { // warns, the fix-it aligns m_nodes_mutex and nLastNodeId
+    std::atomic<uint64_t> nTotalBytesRecv{0};
+    std::atomic<uint64_t> m_total_bytes_sent{0}; // doesn't warn unless SeparateAtomics, atomics are one group
+    Mutex m_nodes_mutex;
+    int m_node_count GUARDED_BY(m_nodes_mutex){0}; // doesn't warn, same lock as the line it shares
+    std::atomic<int> nLastNodeId{0};
+};
+
+class Separated { // doesn't warn, nothing else within a line of each atomic
+    std::atomic<int> m_a{0};
+    char m_padding_a[64];
+    std::atomic<int> m_b{0};
+};
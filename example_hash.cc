@@ -0,0 +1,82 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about hashes recomputed for the same object.
+#include <map>
+#include <memory>
+#include <vector>
+
+struct uint256 {
+    unsigned char data[32];
+    bool operator<(const uint256& other) const;
+    bool operator==(const uint256& other) const;
+};
+
+struct CTransaction {
+    uint256 GetHash() const;
+    uint256 GetWitnessHash() const;
+};
+using CTransactionRef = std::shared_ptr<const CTransaction>;
+
+struct CBlock {
+    std::vector<CTransactionRef> vtx;
+    uint256 GetHash() const;
+};
+
+std::map<uint256, CTransactionRef> mapTx;
+
+void AddTx(const CTransactionRef& tx)
+{
+    if (mapTx.count(tx->GetHash())) return; // warns, gets the fix-it
+    mapTx.emplace(tx->GetHash(), tx);
+}
+
+bool IsWitnessOf(const CTransaction& tx, const uint256& hash)
+{
+    return tx.GetWitnessHash() == hash || tx.GetWitnessHash() == uint256{}; // warns, gets the fix-it
+}
+
+int CountBlockTx(const CBlock& block, const std::vector<uint256>& hashes)
+{
+    int count = 0;
+    for (const auto& hash : hashes) {
+        if (block.GetHash() == hash) ++count; // warns, loop invariant, hoisted above the loop
+    }
+    for (const auto& tx : block.vtx) {
+        mapTx.emplace(tx->GetHash(), tx); // doesn't warn, a different tx every iteration
+    }
+    return count;
+}
+
+void Lookup(const CTransactionRef& ptx)
+{
+    if (ptx && mapTx.count(ptx->GetHash())) { // warns, no fix-it: would bypass the null check
+        mapTx.erase(ptx->GetHash());
+    }
+}
+
+void Mutated(CBlock block)
+{
+    uint256 before = block.GetHash(); // doesn't warn, block is modified
+    block.vtx.clear();
+    uint256 after = block.GetHash();
+    (void)before;
+    (void)after;
+}
+
+void Finalize(CBlock* pblock);
+
+void Rehash(CBlock* pblock)
+{
+    uint256 before = pblock->GetHash(); // warns, no fix-it: *pblock isn't const, Finalize may change it
+    Finalize(pblock);
+    uint256 after = pblock->GetHash();
+    (void)before;
+    (void)after;
+}
+
+int main()
+{
+    AddTx(std::make_shared<const CTransaction>());
+}
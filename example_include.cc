@@ -0,0 +1,23 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Rank includes by parse cost and report the ones that can go.
+#include "example.h" // warns, nothing from it or early_exit.h is used
+#include "example_include_view.h" // warns, replaced by "namespace node { class CoinsView; }"
+#include "example_include_coins.h" // doesn't warn, Coin is used (even though the line above brought it in)
+#include "example_include_coins.h" // warns, duplicate
+
+#include <vector> // doesn't warn, angled includes are skipped unless CheckAngledIncludes is set
+
+long long Total(const node::CoinsView* view, const std::vector<Coin>& coins)
+{
+    long long total = 0;
+    for (const Coin& coin : coins) total += coin.value;
+    return view ? total : 0;
+}
+
+int main()
+{
+    return Total(nullptr, {}) == 0 ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef EXAMPLE_INCLUDE_COINS_H
+#define EXAMPLE_INCLUDE_COINS_H
+
+struct Coin {
+    long long value;
+};
+
+#endif // EXAMPLE_INCLUDE_COINS_H
@@ -0,0 +1,18 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef EXAMPLE_INCLUDE_VIEW_H
+#define EXAMPLE_INCLUDE_VIEW_H
+
+#include "example_include_coins.h"
+
+namespace node {
+class CoinsView {
+public:
+    virtual ~CoinsView() = default;
+    virtual bool GetCoin(int n, Coin& coin) const;
+};
+} // namespace node
+
+#endif // EXAMPLE_INCLUDE_VIEW_H
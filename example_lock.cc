@@ -0,0 +1,58 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about expensive calls made while holding a lock.
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+using Mutex = std::mutex;
+
+template <typename MutexType>
+class UniqueLock : public std::unique_lock<MutexType> {
+public:
+    UniqueLock(MutexType& m, const char*, const char*, int) : std::unique_lock<MutexType>(m) {}
+};
+
+template <typename MutexType>
+MutexType& MaybeCheckNotHeld(MutexType& cs) { return cs; }
+
+#define PASTE(x, y) x ## y
+#define PASTE2(x, y) PASTE(x, y)
+#define UNIQUE_NAME(name) PASTE2(name, __COUNTER__)
+#define LOCK(cs) UniqueLock<decltype(cs)> UNIQUE_NAME(criticalblock)(MaybeCheckNotHeld(cs), #cs, __FILE__, __LINE__)
+#define LOCK2(cs1, cs2)                                               \
+    UniqueLock<decltype(cs1)> criticalblock1(MaybeCheckNotHeld(cs1), #cs1, __FILE__, __LINE__); \
+    UniqueLock<decltype(cs2)> criticalblock2(MaybeCheckNotHeld(cs2), #cs2, __FILE__, __LINE__)
+#define WITH_LOCK(cs, code) [&]() -> decltype(auto) { LOCK(cs); code; }()
+
+void LogPrintf_(const char* fmt) {}
+
+struct uint256 {};
+struct CBlockHeader {
+    uint256 GetHash() const { return {}; }
+};
+
+Mutex cs_main;
+Mutex g_file_mutex;
+
+void FlushBlock(FILE* file, const CBlockHeader& header)
+{
+    uint256 hash = header.GetHash(); // doesn't warn, not locked yet
+    LOCK(cs_main);
+    header.GetHash(); // warns, cs_main
+    {
+        LOCK(g_file_mutex);
+        fflush(file); // warns once, for cs_main
+    }
+    auto later = [&] { LogPrintf_("later\n"); }; // doesn't warn, may run unlocked
+    later();
+}
+
+void WithLock(const CBlockHeader& header)
+{
+    WITH_LOCK(cs_main, LogPrintf_("locked\n")); // warns, cs_main
+    LOCK2(cs_main, g_file_mutex);
+    header.GetHash(); // warns, cs_main
+}
@@ -3,7 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 // Warn about any use of LogPrintf that does not end with a newline.
+// With ExpensiveArguments set, also warn about arguments that are hashed,
+// formatted or allocated even when nothing gets logged.
 #include <string>
+#include <vector>
 
 enum LogFlags {
     NONE
@@ -44,3 +47,26 @@ void bad_func2()
 {
     LogPrintf("hello world!..");
 }
+
+struct uint256 {
+    std::string ToString() const { return {}; }
+};
+
+struct CTransaction {
+    uint256 GetHash() const { return {}; }
+    std::vector<int> vin;
+};
+
+std::string HexStr(const std::vector<unsigned char>& vch) { return {}; }
+
+void expensive_args(const CTransaction& tx, const std::vector<unsigned char>& data, const std::string& name)
+{
+    LogPrintf("tx %s\n", tx.GetHash().ToString()); // warns, hashing
+    LogPrintf("data %s\n", HexStr(data)); // warns, formatting
+    LogPrintf("name %s\n", name + "!"); // warns, allocating
+    LogPrintf("name %s inputs %d\n", name, tx.vin.size()); // doesn't warn, cheap
+    LogPrint(NONE, "tx %s\n", tx.GetHash().ToString()); // doesn't warn, gated
+    for (int i = 0; i < 10; ++i) {
+        LogPrint(NONE, "data %s\n", HexStr(data)); // warns, in a loop
+    }
+}
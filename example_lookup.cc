@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about associative container lookups that build a temporary key.
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using ArgsMap = std::map<std::string, std::vector<std::string>>; // gets the fix-it once
+
+struct ArgsManager {
+    ArgsMap m_settings;
+    std::set<std::string> m_network_only_args; // gets a note, no fix-it: GetNetworkOnlyArgs() spells the type
+    std::unordered_map<std::string, int> m_flags;
+
+    bool IsSet(std::string_view name) const
+    {
+        return m_settings.count(std::string{name}) > 0; // doesn't warn, explicit
+    }
+
+    bool IsNetworkOnly(const char* name) const
+    {
+        return m_network_only_args.find(name) != m_network_only_args.end(); // warns
+    }
+
+    const std::set<std::string>& GetNetworkOnlyArgs() const { return m_network_only_args; }
+
+    bool HasFlag(const char* name) const
+    {
+        return m_flags.count(name) > 0; // warns in C++20 only, no fix-it: needs a transparent hasher
+    }
+};
+
+bool Lookup(const ArgsMap& settings, const char* name)
+{
+    return settings.find(name) != settings.end(); // warns, fix-it on ArgsMap
+}
+
+bool LookupOwned(const ArgsMap& settings, const std::string& name)
+{
+    return settings.find(name) != settings.end(); // doesn't warn
+}
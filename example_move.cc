@@ -0,0 +1,112 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about locals copied on their last use.
+#include <map>
+#include <string>
+#include <vector>
+
+void Relay(std::vector<unsigned char> data);
+void Log(const std::vector<unsigned char>& data);
+
+struct Peer {
+    std::string m_addr_name;
+    std::vector<std::string> m_messages;
+    std::map<std::string, std::vector<unsigned char>> m_blobs;
+
+    void SetName(const std::string& host, int port)
+    {
+        std::string name = host + ":" + std::to_string(port);
+        m_addr_name = name; // warns, gets the fix-it
+    }
+
+    void Queue(const std::string& prefix)
+    {
+        std::string msg = prefix;
+        msg += "\n";
+        m_messages.push_back(msg); // warns, gets the fix-it
+    }
+
+    void QueueAll(const std::vector<std::string>& msgs)
+    {
+        std::string last;
+        for (const auto& msg : msgs) {
+            std::string line = msg + "\n";
+            m_messages.push_back(line); // warns, line is declared again every iteration
+            last = msg;
+            m_messages.push_back(last); // doesn't warn, last is used again in the next iteration
+        }
+    }
+
+    void QueueFront(const std::string& prefix)
+    {
+        std::string msg = prefix + "\n";
+        m_messages.insert(m_messages.begin(), msg); // warns, gets the fix-it: insert(const_iterator, value_type&&) exists
+    }
+
+    void Store(const std::string& key)
+    {
+        std::vector<unsigned char> blob(32);
+        m_blobs.emplace(key, blob); // warns, gets the fix-it
+    }
+};
+
+void Send(bool log)
+{
+    std::vector<unsigned char> data{1, 2, 3};
+    Relay(data); // doesn't warn, may still be logged
+    if (log) Log(data);
+}
+
+void SendOnce()
+{
+    std::vector<unsigned char> data{1, 2, 3};
+    for (unsigned char c : data) (void)c; // fine, the loop ends before the move
+    Relay(data); // warns, gets the fix-it
+}
+
+void SendAliased()
+{
+    std::vector<unsigned char> data{1, 2, 3};
+    const unsigned char& first = data.front();
+    Relay(data); // doesn't warn, first would dangle
+    (void)first;
+}
+
+struct Cursor {
+    const unsigned char* m_pos{nullptr};
+    std::vector<unsigned char>::const_iterator m_it;
+};
+
+void SendTracked(Cursor& cursor, std::vector<const std::vector<unsigned char>*>& pending)
+{
+    std::vector<unsigned char> data{1, 2, 3};
+    cursor.m_pos = data.data();
+    Relay(data); // doesn't warn, cursor.m_pos would dangle
+    std::vector<unsigned char> next{4, 5};
+    cursor.m_it = next.cbegin();
+    Relay(next); // doesn't warn, cursor.m_it would dangle
+    std::vector<unsigned char> queued{6, 7};
+    pending.push_back(&queued);
+    Relay(queued); // doesn't warn, pending would dangle
+    std::vector<unsigned char> last{8};
+    const size_t size = last.size();
+    Relay(last); // warns, size is a copy
+    (void)size;
+}
+
+void SendUnsequenced(std::vector<std::vector<unsigned char>>& out)
+{
+    std::vector<unsigned char> data{1, 2, 3};
+    out.emplace_back(data); // warns, gets the fix-it
+    std::vector<unsigned char> sized{4, 5};
+    out.insert(out.begin() + sized.size(), sized); // doesn't warn, sized.size() may run after the move
+}
+
+int main()
+{
+    Send(true);
+    SendOnce();
+    SendAliased();
+}
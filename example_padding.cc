@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about padding in records that are kept around in large numbers.
+// Run with -config="{CheckOptions: [{key: bitcoin-record-padding.HotFields, value: 'CBlockIndex::nStatus'},
+//                                   {key: bitcoin-record-padding.InstanceCounts, value: 'CCoinsCacheEntry=1000000;CTxMemPoolEntry=1000000;CBlockIndex=1000000;CNodeState=1000'}]}"
+#include <cstdint>
+
+struct CCoinsCacheEntry { // warns, 16 bytes instead of 24, gets the fix-it
+    CCoinsCacheEntry() = default;
+    explicit CCoinsCacheEntry(int64_t value) : flags{0}, nValue{value} {}
+
+    //! Dirty/fresh bits
+    unsigned char flags{0};
+    int64_t nValue{-1};
+    bool fCoinBase{false};
+};
+
+struct CTxMemPoolEntry { // warns, no fix-it: aggregate initialization is positional
+    bool m_dirty;
+    uint64_t m_fee;
+    bool m_prioritized;
+};
+
+class CBlockIndex { // warns, gets the fix-it
+public:
+    CBlockIndex() : pprev{nullptr}, nHeight{0} {}
+
+    CBlockIndex* pprev;
+    int nHeight;
+    uint64_t nTimeMax;
+    unsigned char data[48];
+    uint32_t nStatus{0}; // hot, ends at byte 72, moved to the front
+};
+
+struct Flag {
+    bool set;
+    ~Flag();
+};
+struct Handle {
+    void* ptr;
+    ~Handle();
+};
+
+class CNodeState { // warns, 24 bytes instead of 32, no fix-it: m_flag and m_handle would be destroyed in the other order
+public:
+    explicit CNodeState(int64_t time) : m_time{time} {}
+
+    Flag m_flag;
+    int64_t m_time;
+    bool m_connected{false};
+    Handle m_handle;
+};
+
+struct Unlisted { // doesn't warn, not in InstanceCounts
+    bool a;
+    uint64_t b;
+    bool c;
+};
@@ -0,0 +1,50 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about vectors grown in loops with a known trip count without reserve().
+#include <cstddef>
+#include <vector>
+
+struct CTxIn {
+    int prevout;
+};
+
+struct CTransaction {
+    std::vector<CTxIn> vin;
+};
+
+std::vector<int> Prevouts(const CTransaction& tx)
+{
+    std::vector<int> ret;
+    for (const auto& in : tx.vin) {
+        ret.push_back(in.prevout); // warns, ret.reserve(tx.vin.size());
+    }
+    return ret;
+}
+
+void AppendPrevouts(const CTransaction& tx, std::vector<int>& out)
+{
+    for (size_t i = 0; i < tx.vin.size(); ++i) {
+        out.push_back(tx.vin[i].prevout); // warns, no fix-it: the caller owns out
+    }
+}
+
+std::vector<int> Reserved(const CTransaction& tx)
+{
+    std::vector<int> ret;
+    ret.reserve(tx.vin.size());
+    for (const auto& in : tx.vin) {
+        ret.push_back(in.prevout); // doesn't warn
+    }
+    return ret;
+}
+
+std::vector<int> Filtered(const CTransaction& tx)
+{
+    std::vector<int> ret;
+    for (const auto& in : tx.vin) {
+        if (in.prevout) ret.push_back(in.prevout); // doesn't warn, conditional
+    }
+    return ret;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about shared_ptr copies that only churn the refcount.
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct CTransaction {
+    std::vector<unsigned char> vin;
+};
+using CTransactionRef = std::shared_ptr<const CTransaction>;
+
+struct CTxMemPool {
+    std::vector<CTransactionRef> m_txs;
+    void Add(CTransactionRef tx) { m_txs.push_back(tx); } // warns, std::move(tx)
+};
+
+size_t Size(CTransactionRef tx); // also gets the fix-it
+size_t Size(CTransactionRef tx) // warns, const CTransactionRef&
+{
+    return tx->vin.size();
+}
+
+void Relay(CTxMemPool& pool, CTransactionRef tx)
+{
+    pool.m_txs.push_back(tx); // warns, std::move(tx)
+}
+
+void RelayFirst(CTxMemPool& pool, CTransactionRef tx)
+{
+    pool.m_txs.insert(pool.m_txs.begin(), tx); // warns, std::move(tx): insert(const_iterator, value_type&&) exists
+}
+
+void Process(CTxMemPool& pool, const std::vector<CTransactionRef>& txs)
+{
+    for (const auto& ref : txs) {
+        CTransactionRef tx = ref; // doesn't warn, ref is a reference
+        pool.Add(tx); // warns, std::move(tx)
+    }
+    CTransactionRef first = txs.front();
+    auto copy = first; // warns, const auto&
+    size_t total = copy->vin.size();
+    auto task = [first] { return first->vin.size(); }; // warns, first = std::move(first)
+    total += task();
+}
+
+void Keep(CTxMemPool& pool, CTransactionRef tx)
+{
+    pool.Add(tx); // doesn't warn, used below
+    pool.Add(tx); // warns, std::move(tx)
+}
+
+void Forward(CTxMemPool& pool, CTransactionRef tx)
+{
+    CTransactionRef view = tx; // warns, const CTransactionRef&
+    pool.Add(tx); // doesn't warn, view would refer to the moved-from tx
+    (void)view->vin.size();
+}
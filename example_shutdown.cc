@@ -0,0 +1,78 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about shutdown polled on every iteration of cheap loops.
+#include <cstdint>
+#include <map>
+#include <vector>
+
+bool ShutdownRequested();
+
+struct COutPoint {
+    uint32_t n;
+    bool operator<(const COutPoint& other) const { return n < other.n; }
+};
+struct CTxIn {
+    COutPoint prevout;
+};
+struct CTransaction {
+    std::vector<CTxIn> vin;
+};
+struct CCursor {
+    bool Valid() const;
+    void Next();
+    bool GetValue(int64_t& value) const;
+};
+
+void Flush();
+void Sync();
+void Write(int64_t value);
+void Log(int64_t value);
+
+bool SumInputs(const std::vector<CTransaction>& txs, const std::map<COutPoint, int64_t>& coins, int64_t& sum)
+{
+    for (const auto& tx : txs) {
+        for (const auto& txin : tx.vin) {
+            if (ShutdownRequested()) return false; // warns, gets the fix-it with the counter above the outer loop
+            sum += coins.at(txin.prevout);
+        }
+    }
+    return true;
+}
+
+int64_t SumCursor(CCursor& cursor)
+{
+    int64_t sum = 0;
+    while (cursor.Valid() && !ShutdownRequested()) { // warns, gets the fix-it
+        int64_t value;
+        if (cursor.GetValue(value)) sum += value;
+        cursor.Next();
+    }
+    return sum;
+}
+
+void WriteAll(const std::vector<int64_t>& values)
+{
+    for (const auto value : values) {
+        if (ShutdownRequested()) return; // doesn't warn, the body is expensive enough
+        Write(value);
+        Log(value);
+        Flush();
+        Sync();
+        Write(-value);
+    }
+}
+
+bool SumBoth(const std::vector<int64_t>& a, const std::vector<int64_t>& b, int64_t& sum)
+{
+    for (const auto value : a) {
+        if (ShutdownRequested()) return false; // warns, gets the fix-it
+        sum += value;
+    }
+    for (const auto value : b) {
+        if (ShutdownRequested()) return false; // warns, no fix-it: the block already gets a counter
+        sum += value;
+    }
+    return true;
+}
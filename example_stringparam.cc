@@ -0,0 +1,44 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Warn about const std::string& parameters that call sites bind string
+// literals or const char* to.
+#include <string> // the fix-its add <string_view> after this
+
+template <typename... Args>
+static inline void LogPrintf_(const std::string& logging_function, const std::string& source_file, const int source_line, const char* fmt, const Args&... args)
+{
+    // Only reads its arguments: both get a std::string_view fix-it.
+    if (logging_function.empty() || source_file.size() > 100) return;
+}
+
+#define LogPrintf(...) LogPrintf_(__func__, __FILE__, __LINE__, __VA_ARGS__)
+
+bool IsSet(const std::string& name); // also gets the fix-it
+bool IsSet(const std::string& name)
+{
+    return name == "-debug";
+}
+
+std::string g_last;
+void Remember(const std::string& name) // warns, but no fix-it as it keeps a copy
+{
+    g_last = name;
+}
+
+bool HasPrefix(const std::string& name) // warns, but no fix-it as substr() would return a view
+{
+    return name.substr(0, 1) == std::string{"-"};
+}
+
+void callers(const char* arg, const std::string& owned)
+{
+    LogPrintf("%s\n", arg);
+    LogPrintf("%s\n", owned);
+    IsSet("-debug");
+    IsSet(arg);
+    IsSet(owned); // doesn't count
+    Remember("foo");
+    HasPrefix("-debug");
+}
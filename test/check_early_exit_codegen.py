@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Cory Fields
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+'''
+Checks the code the early-exit macros compile to.
+
+Compiles the Sample* functions of a source file at -O2 to assembly and fails
+unless, in each of them:
+- the call is followed by a single compare or test of the status and a
+  conditional branch,
+- the branch leaves the fast path (everything up to its first return), and
+  that path never calls early_exit_detail::Access::Propagate.
+Propagate itself must not be inlined, and must be placed in .text.unlikely.
+
+Understands GCC and Clang assembly for x86-64 and AArch64.
+'''
+
+import argparse
+import re
+import subprocess
+import sys
+
+PROPAGATE = 'early_exit_detail6Access9Propagate'
+CALLS = {'call', 'callq', 'bl'}
+# Branches that test on their own (AArch64).
+FUSED_BRANCHES = {'cbz', 'cbnz', 'tbz', 'tbnz'}
+LABEL = re.compile(r'^([\w.$@]+):')
+
+
+def is_compare(mnemonic):
+    return mnemonic.startswith(('cmp', 'test', 'tst'))
+
+
+def is_conditional_branch(mnemonic):
+    return (mnemonic.startswith('j') and mnemonic not in ('jmp', 'jmpq')) or mnemonic.startswith('b.') or mnemonic in FUSED_BRANCHES
+
+
+def is_branch(mnemonic):
+    return mnemonic.startswith('j') or mnemonic in ('b', 'br') or is_conditional_branch(mnemonic)
+
+
+def parse(asm):
+    '''Returns the section of each global symbol, and the labels and
+    instructions of each symbol with the section they are in.'''
+    sections = {}
+    bodies = {}
+    section = '.text'
+    symbol = None
+    for line in asm.splitlines():
+        line = line.split('#')[0].split('//')[0].strip()
+        if not line:
+            continue
+        match = LABEL.match(line)
+        if match:
+            name = match.group(1)
+            if not name.startswith('.'):
+                symbol = name
+                sections[symbol] = section
+                bodies[symbol] = []
+            elif symbol:
+                bodies[symbol].append((section, 'label', name))
+            continue
+        if line.startswith('.section'):
+            section = line.split(None, 1)[1].split(',')[0].strip()
+        elif line in ('.text', '.data', '.bss'):
+            section = line
+        elif not line.startswith('.') and symbol:
+            parts = line.split(None, 1)
+            bodies[symbol].append((section, parts[0], parts[1] if len(parts) > 1 else ''))
+    return sections, bodies
+
+
+def check_sample(name, section, body):
+    # GCC moves the error path to a separate name.cold symbol, Clang keeps it
+    # behind the return: either way, only code up to the first return in the
+    # function's own section is on the fast path.
+    fast_path = []
+    for item in body:
+        if item[0] != section:
+            continue
+        fast_path.append(item)
+        if item[1] in ('ret', 'retq'):
+            break
+    calls = [i for i, item in enumerate(fast_path) if item[1] in CALLS]
+    if not calls:
+        return 'no call on the fast path'
+    if any(PROPAGATE in item[2] for i, item in enumerate(fast_path) if item[1] in CALLS):
+        return 'Access::Propagate is called on the fast path'
+    compares = 0
+    for item in fast_path[calls[0] + 1:]:
+        mnemonic = item[1]
+        if mnemonic == 'label':
+            continue
+        if mnemonic in CALLS:
+            return 'another call before the status is tested'
+        if is_compare(mnemonic):
+            compares += 1
+            continue
+        if is_branch(mnemonic):
+            if not is_conditional_branch(mnemonic):
+                return 'unconditional {} before the status is tested'.format(mnemonic)
+            compares += mnemonic in FUSED_BRANCHES
+            if compares != 1:
+                return '{} compares before the first branch, expected 1'.format(compares)
+            target = item[2].split(',')[-1].strip()
+            if any(other[1] == 'label' and other[2] == target for other in fast_path):
+                return 'the branch to {} stays on the fast path'.format(target)
+            return None
+    return 'no conditional branch after the call'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--compiler', required=True)
+    parser.add_argument('--include-dir', required=True)
+    parser.add_argument('--define', action='append', default=[], help='preprocessor definition, e.g. EARLY_EXIT_CONTEXT')
+    parser.add_argument('source')
+    args = parser.parse_args()
+
+    cmd = [args.compiler, '-std=c++17', '-O2', '-S', '-o', '-', '-ffunction-sections', '-fno-exceptions', '-fno-rtti',
+           '-fno-asynchronous-unwind-tables', '-I', args.include_dir]
+    cmd += ['-D' + define for define in args.define]
+    cmd.append(args.source)
+    asm = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    sections, bodies = parse(asm)
+
+    failures = []
+    samples = [name for name in sections if 'Sample' in name and not name.endswith('.cold')]
+    if not samples:
+        failures.append('no Sample functions in {}'.format(args.source))
+    for name in samples:
+        error = check_sample(name, sections[name], bodies[name])
+        if error:
+            failures.append('{}: {}'.format(name, error))
+    propagates = [name for name in sections if PROPAGATE in name]
+    if not propagates:
+        failures.append('Access::Propagate was inlined')
+    for name in propagates:
+        if not sections[name].startswith('.text.unlikely'):
+            failures.append('{} is in {}, not .text.unlikely'.format(name, sections[name]))
+
+    for failure in failures:
+        print(failure, file=sys.stderr)
+    if not failures:
+        print('{} sample(s): single test-and-branch, Access::Propagate outlined'.format(len(samples)))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
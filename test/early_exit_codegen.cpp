@@ -0,0 +1,41 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Compiled to assembly by check_early_exit_codegen.py, never linked. The
+// callees are external so that each Sample* function keeps the call, the
+// status test and the error path of the macro it uses.
+
+#include "early_exit.h"
+
+#include <memory>
+
+MaybeEarlyExit<bool> Leaf(int i);
+MaybeEarlyExit<int> Value(int i);
+MaybeEarlyExit<std::unique_ptr<int>> Owned(int i);
+MaybeEarlyExit<> Step(int i);
+
+MaybeEarlyExit<bool> SampleIf(int i)
+{
+    EXIT_OR_IF_NOT(Leaf(i)) return false;
+    return true;
+}
+
+MaybeEarlyExit<> SampleDecl(int i, int& out)
+{
+    EXIT_OR_DECL(const int v, Value(i));
+    out = v;
+    return {};
+}
+
+MaybeEarlyExit<> SampleAssign(int i, std::unique_ptr<int>& out)
+{
+    EXIT_OR_ASSIGN(out, Owned(i));
+    return {};
+}
+
+MaybeEarlyExit<> SampleMaybeExit(int i)
+{
+    MAYBE_EXIT(Step(i));
+    return {};
+}
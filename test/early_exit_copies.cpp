@@ -0,0 +1,123 @@
+// Copyright (c) 2022 Cory Fields
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Values handed through the early-exit macros are moved, never copied.
+// Counted tracks its copies and moves at runtime; a move-only type fails to
+// compile on any copy.
+
+#include "early_exit.h"
+
+#include <cstdio>
+#include <memory>
+
+static int g_failures{0};
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++g_failures; } } while (0)
+
+struct Counted {
+    static inline int copies{0};
+    static inline int moves{0};
+
+    int value{0};
+
+    Counted() = default;
+    explicit Counted(int v) : value(v) {}
+    Counted(const Counted& other) : value(other.value) { ++copies; }
+    Counted(Counted&& other) noexcept : value(other.value) { ++moves; }
+    Counted& operator=(const Counted& other) { value = other.value; ++copies; return *this; }
+    Counted& operator=(Counted&& other) noexcept { value = other.value; ++moves; return *this; }
+};
+
+static MaybeEarlyExit<Counted> make_counted(int v)
+{
+    if (v < 0) return FatalError::BLOCK_READ_FAILED;
+    return Counted{v};
+}
+
+static MaybeEarlyExit<int> decl_counted(int v)
+{
+    EXIT_OR_DECL(Counted c, make_counted(v));
+    return c.value;
+}
+
+static MaybeEarlyExit<int> assign_counted(int v)
+{
+    Counted c;
+    EXIT_OR_ASSIGN(c, make_counted(v));
+    return c.value;
+}
+
+static MaybeEarlyExit<Counted> forward_counted(int v)
+{
+    EXIT_OR_DECL(Counted c, make_counted(v));
+    return c;
+}
+
+static MaybeEarlyExit<std::unique_ptr<int>> make_ptr(int v)
+{
+    if (v < 0) return FatalError::BLOCK_READ_FAILED;
+    return std::make_unique<int>(v);
+}
+
+static MaybeEarlyExit<int> decl_ptr(int v)
+{
+    EXIT_OR_DECL(std::unique_ptr<int> p, make_ptr(v));
+    return *p;
+}
+
+static MaybeEarlyExit<int> assign_ptr(int v)
+{
+    std::unique_ptr<int> p;
+    EXIT_OR_ASSIGN(p, make_ptr(v));
+    return *p;
+}
+
+static MaybeEarlyExit<std::unique_ptr<int>> forward_ptr(int v)
+{
+    EXIT_OR_DECL(std::unique_ptr<int> p, make_ptr(v));
+    return p;
+}
+
+int main()
+{
+    {
+        auto ret = decl_counted(1);
+        CHECK(!ret.ShouldEarlyExit() && *ret == 1);
+        CHECK(decl_counted(-1).ShouldEarlyExit());
+    }
+    {
+        auto ret = assign_counted(2);
+        CHECK(!ret.ShouldEarlyExit() && *ret == 2);
+        CHECK(assign_counted(-1).ShouldEarlyExit());
+    }
+    {
+        auto ret = forward_counted(3);
+        CHECK(!ret.ShouldEarlyExit() && (*ret).value == 3);
+        CHECK(forward_counted(-1).ShouldEarlyExit());
+    }
+    {
+        Counted out;
+        CHECK(make_counted(4).TryMoveOut(out) && out.value == 4);
+        CHECK(!make_counted(-1).TryMoveOut(out) && out.value == 4);
+    }
+    CHECK(Counted::copies == 0);
+    CHECK(Counted::moves > 0);
+
+    {
+        auto ret = decl_ptr(5);
+        CHECK(!ret.ShouldEarlyExit() && *ret == 5);
+        CHECK(decl_ptr(-1).ShouldEarlyExit());
+        auto assigned = assign_ptr(6);
+        CHECK(!assigned.ShouldEarlyExit() && *assigned == 6);
+        CHECK(assign_ptr(-1).ShouldEarlyExit());
+        auto ptr = forward_ptr(7);
+        CHECK(!ptr.ShouldEarlyExit() && **ptr == 7);
+        CHECK(forward_ptr(-1).ShouldEarlyExit());
+        std::unique_ptr<int> out;
+        CHECK(make_ptr(8).TryMoveOut(out) && *out == 8);
+    }
+
+    std::printf("copies: %d, moves: %d\n", Counted::copies, Counted::moves);
+    return g_failures == 0 ? 0 : 1;
+}